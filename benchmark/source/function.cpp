@@ -0,0 +1,141 @@
+#include <benchmark/benchmark.h>
+#include <glue/lua/state.h>
+
+#include <sol/sol.hpp>
+#include <string>
+#include <vector>
+
+static void callLuaFunctionWithNumbers(benchmark::State &benchmarkState) {
+  glue::lua::State state;
+  auto f = state.get("function(a, b) return a + b end").asFunction();
+  for (auto _ : benchmarkState) {
+    benchmark::DoNotOptimize(f(1, 2.5));
+  }
+}
+
+BENCHMARK(callLuaFunctionWithNumbers);
+
+/**
+ * Baseline for `callLuaFunctionWithNumbers`, converting arguments and results through
+ * registry-backed `sol::object`s as calls did before values were pushed directly.
+ */
+static void callLuaFunctionWithNumbersThroughSolObjects(benchmark::State &benchmarkState) {
+  glue::lua::State state;
+  auto luaState = state.getRawLuaState();
+  sol::state_view view(luaState);
+  sol::function f = view.script("return function(a, b) return a + b end");
+  for (auto _ : benchmarkState) {
+    glue::AnyArguments args{glue::Any(1), glue::Any(2.5)};
+    f.push(luaState);
+    sol::make_object(luaState, args[0].get<int>()).push(luaState);
+    sol::make_object(luaState, args[1].get<double>()).push(luaState);
+    lua_call(luaState, 2, 1);
+    auto result = sol::stack::pop<sol::object>(luaState);
+    benchmark::DoNotOptimize(glue::Any(result.as<double>()));
+  }
+}
+
+BENCHMARK(callLuaFunctionWithNumbersThroughSolObjects);
+
+static void callLuaFunctionWithStrings(benchmark::State &benchmarkState) {
+  glue::lua::State state;
+  auto f = state.get("function(a, b) return a end").asFunction();
+  std::string a = "hello", b = "lua";
+  for (auto _ : benchmarkState) {
+    benchmark::DoNotOptimize(f(a, b));
+  }
+}
+
+BENCHMARK(callLuaFunctionWithStrings);
+
+static void callLuaFunctionWithTable(benchmark::State &benchmarkState) {
+  glue::lua::State state;
+  auto table = state.get("{a = 1}");
+  auto f = state.get("function(t) return t end").asFunction();
+  for (auto _ : benchmarkState) {
+    benchmark::DoNotOptimize(f(table.data));
+  }
+}
+
+BENCHMARK(callLuaFunctionWithTable);
+
+static void callLuaFunctionWithMultipleResults(benchmark::State &benchmarkState) {
+  glue::lua::State state;
+  auto f = state.get("function(a, b) return a + b, a * b end");
+  for (auto _ : benchmarkState) {
+    benchmark::DoNotOptimize(state.call(f, 1, 2.5));
+  }
+}
+
+BENCHMARK(callLuaFunctionWithMultipleResults);
+
+static void callLuaFunctionReturningTable(benchmark::State &benchmarkState) {
+  glue::lua::State state;
+  auto f = state.get("function(a, b) return {a + b, a * b} end").asFunction();
+  for (auto _ : benchmarkState) {
+    benchmark::DoNotOptimize(f(1, 2.5));
+  }
+}
+
+BENCHMARK(callLuaFunctionReturningTable);
+
+static void callCppFunctionFromLua(benchmark::State &benchmarkState) {
+  glue::lua::State state;
+  state.root()["add"] = [](int a, int b) { return a + b; };
+  auto loop = state.get("function(n) local x = 0 for i = 1, n do x = add(x, i) end return x end")
+                  .asFunction();
+  int calls = 1000;
+  for (auto _ : benchmarkState) {
+    benchmark::DoNotOptimize(loop(calls));
+  }
+  benchmarkState.SetItemsProcessed(benchmarkState.iterations() * calls);
+}
+
+BENCHMARK(callCppFunctionFromLua);
+
+static void callAnyFunctionFromLua(benchmark::State &benchmarkState) {
+  glue::lua::State state;
+  state.root()["add"] = [](const glue::AnyArguments &args) -> glue::Any {
+    return args[0].get<int>() + args[1].get<int>();
+  };
+  auto loop = state.get("function(n) local x = 0 for i = 1, n do x = add(x, i) end return x end")
+                  .asFunction();
+  int calls = 1000;
+  for (auto _ : benchmarkState) {
+    benchmark::DoNotOptimize(loop(calls));
+  }
+  benchmarkState.SetItemsProcessed(benchmarkState.iterations() * calls);
+}
+
+BENCHMARK(callAnyFunctionFromLua);
+
+static void callLuaFunctionPerRow(benchmark::State &benchmarkState) {
+  glue::lua::State state;
+  auto f = state.get("function(a, b) return a * b end").asFunction();
+  std::vector<double> a(size_t(benchmarkState.range(0)), 1.5), results(a.size());
+  for (auto _ : benchmarkState) {
+    for (size_t i = 0; i < a.size(); ++i) {
+      results[i] = f(a[i], a[i]).get<double>();
+    }
+    benchmark::DoNotOptimize(results.data());
+  }
+  benchmarkState.SetItemsProcessed(benchmarkState.iterations() * benchmarkState.range(0));
+}
+
+BENCHMARK(callLuaFunctionPerRow)->Range(1 << 10, 1 << 17);
+
+static void callLuaFunctionBatched(benchmark::State &benchmarkState) {
+  glue::lua::State state;
+  auto f = state.get("function(a, b) return a * b end");
+  std::vector<double> a(size_t(benchmarkState.range(0)), 1.5), results(a.size());
+  glue::lua::Batch batch(a.size());
+  batch.addColumn(glue::lua::Buffer(a.data(), a.size()))
+      .addColumn(glue::lua::Buffer(a.data(), a.size()));
+  for (auto _ : benchmarkState) {
+    state.callBatch(f, batch, glue::lua::Buffer(results.data(), results.size()));
+    benchmark::DoNotOptimize(results.data());
+  }
+  benchmarkState.SetItemsProcessed(benchmarkState.iterations() * benchmarkState.range(0));
+}
+
+BENCHMARK(callLuaFunctionBatched)->Range(1 << 10, 1 << 17);
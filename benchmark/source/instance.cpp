@@ -0,0 +1,75 @@
+#include <benchmark/benchmark.h>
+#include <glue/class.h>
+#include <glue/lua/state.h>
+
+namespace {
+
+  struct Vector {
+    double x, y;
+    Vector(double x, double y) : x(x), y(y) {}
+    double length2() const { return x * x + y * y; }
+  };
+
+  void addVectorModule(glue::lua::State &state) {
+    auto module = glue::createAnyMap();
+    module["Vector"] = glue::createClass<Vector>()
+                           .addConstructor<double, double>()
+                           .addMember("x", &Vector::x)
+                           .addMember("y", &Vector::y)
+                           .addMethod("length2", &Vector::length2)
+                           .addMethod(glue::keys::operators::add,
+                                      [](const Vector &a, const Vector &b) {
+                                        return Vector(a.x + b.x, a.y + b.y);
+                                      });
+    state.addModule(module);
+  }
+
+}  // namespace
+
+static void callInstanceMethod(benchmark::State &benchmarkState) {
+  glue::lua::State state;
+  addVectorModule(state);
+  auto loop = state
+                  .get("function(n) local v, x = Vector.__new(1, 2), 0 "
+                       "for i = 1, n do x = x + v:length2() end return x end")
+                  .asFunction();
+  int calls = 1000;
+  for (auto _ : benchmarkState) {
+    benchmark::DoNotOptimize(loop(calls));
+  }
+  benchmarkState.SetItemsProcessed(benchmarkState.iterations() * calls);
+}
+
+BENCHMARK(callInstanceMethod);
+
+static void callInstanceOperator(benchmark::State &benchmarkState, bool storeInline) {
+  glue::lua::State state;
+  addVectorModule(state);
+  if (storeInline) {
+    state.addInlineType<Vector>();
+  }
+  auto loop = state
+                  .get("function(n) local v, d = Vector.__new(0, 0), Vector.__new(1, 1) "
+                       "for i = 1, n do v = v + d end return v end")
+                  .asFunction();
+  int calls = 1000;
+  for (auto _ : benchmarkState) {
+    benchmark::DoNotOptimize(loop(calls));
+  }
+  benchmarkState.SetItemsProcessed(benchmarkState.iterations() * calls);
+}
+
+BENCHMARK_CAPTURE(callInstanceOperator, boxed, false);
+BENCHMARK_CAPTURE(callInstanceOperator, inline, true);
+
+static void passInstanceToLua(benchmark::State &benchmarkState) {
+  glue::lua::State state;
+  addVectorModule(state);
+  auto x = state.get("function(v) return v:x() end").asFunction();
+  Vector vector(1, 2);
+  for (auto _ : benchmarkState) {
+    benchmark::DoNotOptimize(x(vector));
+  }
+}
+
+BENCHMARK(passInstanceToLua);
@@ -0,0 +1,58 @@
+#include <benchmark/benchmark.h>
+#include <glue/lua/state.h>
+
+#include <string>
+
+static glue::MapValue createTable(glue::lua::State &state, int64_t size) {
+  state.root()["n"] = size;
+  return state.get("(function() local t = {} for i = 1, n do t['k' .. i] = i end return t end)()")
+      .asMap();
+}
+
+static void getLuaMapValue(benchmark::State &benchmarkState) {
+  glue::lua::State state;
+  auto map = state.get("{a = 1, b = 2, c = 3}").asMap();
+  for (auto _ : benchmarkState) {
+    benchmark::DoNotOptimize(map["b"]->get<int>());
+  }
+}
+
+BENCHMARK(getLuaMapValue);
+
+static void setLuaMapValue(benchmark::State &benchmarkState) {
+  glue::lua::State state;
+  auto map = state.get("{a = 1, b = 2, c = 3}").asMap();
+  int value = 0;
+  for (auto _ : benchmarkState) {
+    map["b"] = value++;
+  }
+}
+
+BENCHMARK(setLuaMapValue);
+
+static void iterateLuaMap(benchmark::State &benchmarkState) {
+  glue::lua::State state;
+  auto map = createTable(state, benchmarkState.range(0));
+  for (auto _ : benchmarkState) {
+    size_t count = 0;
+    map.forEach([&](auto &&, auto &&) {
+      ++count;
+      return false;
+    });
+    benchmark::DoNotOptimize(count);
+  }
+  benchmarkState.SetItemsProcessed(benchmarkState.iterations() * benchmarkState.range(0));
+}
+
+BENCHMARK(iterateLuaMap)->RangeMultiplier(10)->Range(10, 10000);
+
+static void getLuaMapKeys(benchmark::State &benchmarkState) {
+  glue::lua::State state;
+  auto map = createTable(state, benchmarkState.range(0));
+  for (auto _ : benchmarkState) {
+    benchmark::DoNotOptimize(map.keys());
+  }
+  benchmarkState.SetItemsProcessed(benchmarkState.iterations() * benchmarkState.range(0));
+}
+
+BENCHMARK(getLuaMapKeys)->RangeMultiplier(10)->Range(10, 10000);
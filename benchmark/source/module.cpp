@@ -0,0 +1,31 @@
+#include <benchmark/benchmark.h>
+#include <glue/lua/state.h>
+
+#include <string>
+
+static glue::MapValue createModule(size_t size) {
+  auto module = glue::createAnyMap();
+  for (size_t i = 0; i < size; ++i) {
+    auto inner = glue::createAnyMap();
+    inner["value"] = int(i);
+    inner["f"] = [](int x) { return x + 1; };
+    module["entry" + std::to_string(i)] = inner;
+  }
+  return module;
+}
+
+static void addModule(benchmark::State &benchmarkState, glue::lua::ModuleLoading loading) {
+  auto module = createModule(size_t(benchmarkState.range(0)));
+  for (auto _ : benchmarkState) {
+    glue::lua::State state;
+    state.addModule(module, loading);
+    benchmark::DoNotOptimize(state.get<int>("entry0.value"));
+  }
+}
+
+BENCHMARK_CAPTURE(addModule, eager, glue::lua::ModuleLoading::Eager)
+    ->RangeMultiplier(10)
+    ->Range(10, 10000);
+BENCHMARK_CAPTURE(addModule, lazy, glue::lua::ModuleLoading::Lazy)
+    ->RangeMultiplier(10)
+    ->Range(10, 10000);
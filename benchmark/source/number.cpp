@@ -0,0 +1,47 @@
+#include <benchmark/benchmark.h>
+#include <glue/lua/state.h>
+
+static void passIntegerToLua(benchmark::State &benchmarkState) {
+  glue::lua::State state;
+  auto root = state.root();
+  int64_t value = 0;
+  for (auto _ : benchmarkState) {
+    root["value"] = value++;
+  }
+}
+
+BENCHMARK(passIntegerToLua);
+
+static void passNumberToLua(benchmark::State &benchmarkState) {
+  glue::lua::State state;
+  auto root = state.root();
+  double value = 0;
+  for (auto _ : benchmarkState) {
+    root["value"] = value;
+    value += 0.5;
+  }
+}
+
+BENCHMARK(passNumberToLua);
+
+static void readIntegerFromLua(benchmark::State &benchmarkState) {
+  glue::lua::State state;
+  state.run("value = 42");
+  auto root = state.root();
+  for (auto _ : benchmarkState) {
+    benchmark::DoNotOptimize(root["value"]->get<int64_t>());
+  }
+}
+
+BENCHMARK(readIntegerFromLua);
+
+static void readNumberFromLua(benchmark::State &benchmarkState) {
+  glue::lua::State state;
+  state.run("value = 0.5");
+  auto root = state.root();
+  for (auto _ : benchmarkState) {
+    benchmark::DoNotOptimize(root["value"]->get<double>());
+  }
+}
+
+BENCHMARK(readNumberFromLua);
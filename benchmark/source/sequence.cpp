@@ -0,0 +1,72 @@
+#include <benchmark/benchmark.h>
+#include <glue/lua/state.h>
+
+#include <string>
+#include <vector>
+
+static void pushNumberSequence(benchmark::State &benchmarkState) {
+  glue::lua::State state;
+  auto length = state.get("function(t) return #t end").asFunction();
+  glue::Any values = std::vector<double>(size_t(benchmarkState.range(0)), 1.5);
+  for (auto _ : benchmarkState) {
+    benchmark::DoNotOptimize(length(values));
+  }
+  benchmarkState.SetItemsProcessed(benchmarkState.iterations() * benchmarkState.range(0));
+}
+
+BENCHMARK(pushNumberSequence)->RangeMultiplier(10)->Range(1000, 10000000);
+
+static void readNumberSequence(benchmark::State &benchmarkState) {
+  glue::lua::State state;
+  state.root()["n"] = int64_t(benchmarkState.range(0));
+  glue::lua::Sequence sequence(
+      state.run("local t = {}; for i = 1, n do t[i] = i * 0.5 end; return t"));
+  std::vector<double> target;
+  for (auto _ : benchmarkState) {
+    sequence.read(target);
+    benchmark::DoNotOptimize(target.data());
+  }
+  benchmarkState.SetItemsProcessed(benchmarkState.iterations() * benchmarkState.range(0));
+}
+
+BENCHMARK(readNumberSequence)->RangeMultiplier(10)->Range(1000, 10000000);
+
+static void pushIntegerSequence(benchmark::State &benchmarkState) {
+  glue::lua::State state;
+  auto length = state.get("function(t) return #t end").asFunction();
+  glue::Any values = std::vector<int64_t>(size_t(benchmarkState.range(0)), 42);
+  for (auto _ : benchmarkState) {
+    benchmark::DoNotOptimize(length(values));
+  }
+  benchmarkState.SetItemsProcessed(benchmarkState.iterations() * benchmarkState.range(0));
+}
+
+BENCHMARK(pushIntegerSequence)->RangeMultiplier(10)->Range(1000, 10000000);
+
+static void pushStringSequence(benchmark::State &benchmarkState) {
+  glue::lua::State state;
+  auto length = state.get("function(t) return #t end").asFunction();
+  glue::Any values = std::vector<std::string>(size_t(benchmarkState.range(0)), "element");
+  for (auto _ : benchmarkState) {
+    benchmark::DoNotOptimize(length(values));
+  }
+  benchmarkState.SetItemsProcessed(benchmarkState.iterations() * benchmarkState.range(0));
+}
+
+BENCHMARK(pushStringSequence)->RangeMultiplier(10)->Range(1000, 10000000);
+
+static void readStringSequence(benchmark::State &benchmarkState) {
+  glue::lua::State state;
+  state.openStandardLibs();
+  state.root()["n"] = int64_t(benchmarkState.range(0));
+  glue::lua::Sequence sequence(
+      state.run("local t = {}; for i = 1, n do t[i] = tostring(i) end; return t"));
+  std::vector<std::string> target;
+  for (auto _ : benchmarkState) {
+    sequence.read(target);
+    benchmark::DoNotOptimize(target.data());
+  }
+  benchmarkState.SetItemsProcessed(benchmarkState.iterations() * benchmarkState.range(0));
+}
+
+BENCHMARK(readStringSequence)->RangeMultiplier(10)->Range(1000, 10000000);
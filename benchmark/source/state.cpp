@@ -0,0 +1,117 @@
+#include <benchmark/benchmark.h>
+#include <glue/lua/state.h>
+#include <glue/lua/state_template.h>
+
+#include <exception>
+#include <string>
+
+static void createState(benchmark::State &benchmarkState) {
+  for (auto _ : benchmarkState) {
+    glue::lua::State state;
+    benchmark::DoNotOptimize(state.getRawLuaState());
+  }
+}
+
+BENCHMARK(createState);
+
+static void createStateWithStandardLibs(benchmark::State &benchmarkState) {
+  for (auto _ : benchmarkState) {
+    glue::lua::State state;
+    state.openStandardLibs();
+    benchmark::DoNotOptimize(state.getRawLuaState());
+  }
+}
+
+BENCHMARK(createStateWithStandardLibs);
+
+static void runExpression(benchmark::State &benchmarkState) {
+  glue::lua::State state;
+  for (auto _ : benchmarkState) {
+    benchmark::DoNotOptimize(state.run("return 1 + 2"));
+  }
+}
+
+BENCHMARK(runExpression);
+
+static void getExpression(benchmark::State &benchmarkState) {
+  glue::lua::State state;
+  for (auto _ : benchmarkState) {
+    benchmark::DoNotOptimize(state.get<int>("1 + 2"));
+  }
+}
+
+BENCHMARK(getExpression);
+
+static void runCompiledChunk(benchmark::State &benchmarkState) {
+  glue::lua::State state;
+  auto chunk = state.compile("return 1 + 2");
+  for (auto _ : benchmarkState) {
+    benchmark::DoNotOptimize(state.run(chunk));
+  }
+}
+
+BENCHMARK(runCompiledChunk);
+
+static glue::MapValue createBootstrapModule() {
+  auto module = glue::createAnyMap();
+  for (int i = 0; i < 1000; ++i) {
+    auto inner = glue::createAnyMap();
+    inner["value"] = i;
+    inner["f"] = [](int x) { return x + 1; };
+    module["entry" + std::to_string(i)] = inner;
+  }
+  return module;
+}
+
+static const char *bootstrapScript = R"(
+  local handlers = {}
+  function register(name, handler) handlers[name] = handler end
+  function dispatch(name, ...) return handlers[name](...) end
+  for i = 1, 100 do register('h' .. i, function(x) return x + i end) end
+)";
+
+static void createInitializedState(benchmark::State &benchmarkState) {
+  auto module = createBootstrapModule();
+  for (auto _ : benchmarkState) {
+    glue::lua::State state;
+    state.openStandardLibs();
+    state.addModule(module);
+    state.run(bootstrapScript);
+    benchmark::DoNotOptimize(state.getRawLuaState());
+  }
+}
+
+BENCHMARK(createInitializedState);
+
+static void createStateFromTemplate(benchmark::State &benchmarkState) {
+  glue::lua::StateTemplate stateTemplate;
+  stateTemplate.openStandardLibs().addModule(createBootstrapModule()).run(bootstrapScript);
+  for (auto _ : benchmarkState) {
+    auto state = stateTemplate.create();
+    benchmark::DoNotOptimize(state->getRawLuaState());
+  }
+}
+
+BENCHMARK(createStateFromTemplate);
+
+static void runFailingScript(benchmark::State &benchmarkState) {
+  glue::lua::State state;
+  for (auto _ : benchmarkState) {
+    try {
+      state.run("error('invalid')");
+    } catch (const std::exception &error) {
+      benchmark::DoNotOptimize(error.what());
+    }
+  }
+}
+
+BENCHMARK(runFailingScript);
+
+static void tryRunFailingScript(benchmark::State &benchmarkState) {
+  glue::lua::State state;
+  for (auto _ : benchmarkState) {
+    benchmark::DoNotOptimize(state.tryRun("error('invalid')").error().message.data());
+  }
+}
+
+BENCHMARK(tryRunFailingScript);
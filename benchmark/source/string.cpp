@@ -0,0 +1,61 @@
+#include <benchmark/benchmark.h>
+#include <glue/lua/state.h>
+
+#include <string>
+
+static void passStringToLua(benchmark::State &benchmarkState) {
+  glue::lua::State state;
+  auto length = state.get("function(s) return #s end").asFunction();
+  std::string value(size_t(benchmarkState.range(0)), 'x');
+  for (auto _ : benchmarkState) {
+    benchmark::DoNotOptimize(length(value));
+  }
+  benchmarkState.SetBytesProcessed(benchmarkState.iterations() * benchmarkState.range(0));
+}
+
+BENCHMARK(passStringToLua)->RangeMultiplier(32)->Range(1 << 10, 1 << 20);
+
+static void readStringFromLua(benchmark::State &benchmarkState) {
+  glue::lua::State state;
+  state.openStandardLibs();
+  state.root()["n"] = int64_t(benchmarkState.range(0));
+  state.run("value = string.rep('x', n)");
+  state.bind("read", [](glue::lua::StringRef value) { benchmark::DoNotOptimize(value.data()); });
+  auto read = state.get("function() read(value) end").asFunction();
+  for (auto _ : benchmarkState) {
+    read();
+  }
+  benchmarkState.SetBytesProcessed(benchmarkState.iterations() * benchmarkState.range(0));
+}
+
+BENCHMARK(readStringFromLua)->RangeMultiplier(32)->Range(1 << 10, 1 << 20);
+
+static void copyStringFromLua(benchmark::State &benchmarkState) {
+  glue::lua::State state;
+  state.openStandardLibs();
+  state.root()["n"] = int64_t(benchmarkState.range(0));
+  state.run("value = string.rep('x', n)");
+  auto get = state.get("function() return value end").asFunction();
+  for (auto _ : benchmarkState) {
+    benchmark::DoNotOptimize(get().get<std::string>());
+  }
+  benchmarkState.SetBytesProcessed(benchmarkState.iterations() * benchmarkState.range(0));
+}
+
+BENCHMARK(copyStringFromLua)->RangeMultiplier(32)->Range(1 << 10, 1 << 20);
+
+static void passStringReferenceToLua(benchmark::State &benchmarkState) {
+  glue::lua::State state;
+  state.openStandardLibs();
+  state.root()["n"] = int64_t(benchmarkState.range(0));
+  glue::lua::StringRef value;
+  state.bind("keep", [&](glue::lua::StringRef string) { value = string; });
+  state.run("keep(string.rep('x', n))");
+  auto length = state.get("function(s) return #s end").asFunction();
+  for (auto _ : benchmarkState) {
+    benchmark::DoNotOptimize(length(value));
+  }
+  benchmarkState.SetBytesProcessed(benchmarkState.iterations() * benchmarkState.range(0));
+}
+
+BENCHMARK(passStringReferenceToLua)->RangeMultiplier(32)->Range(1 << 10, 1 << 20);
@@ -0,0 +1,90 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <vector>
+
+namespace glue {
+  namespace lua {
+
+    /**
+     * Memory usage of a lua state using a `PoolAllocator`.
+     */
+    struct MemoryStats {
+      /** bytes currently allocated by lua */
+      size_t liveBytes = 0;
+      /** maximum of `liveBytes` since the allocator was created */
+      size_t peakBytes = 0;
+      /** bytes reserved from the system, including unused pool memory */
+      size_t reservedBytes = 0;
+      size_t allocations = 0;
+      size_t deallocations = 0;
+      /** allocations rejected because of the memory limit */
+      size_t failedAllocations = 0;
+      /** the memory limit in bytes or `0` if unlimited */
+      size_t limit = 0;
+    };
+
+    /**
+     * A lua allocator that serves small blocks, such as strings, tables and closures, from
+     * per-size-class free lists carved out of larger chunks. Larger blocks are allocated using
+     * `malloc`. The allocator is not thread-safe and may only be used by a single lua state.
+     */
+    class PoolAllocator {
+    public:
+      static constexpr size_t granularity = 16;
+      static constexpr size_t maxPooledSize = 256;
+      static constexpr size_t chunkSize = 64 * 1024;
+
+    private:
+      struct FreeBlock {
+        FreeBlock *next;
+      };
+
+      std::array<FreeBlock *, maxPooledSize / granularity> freeLists{};
+      std::vector<void *> chunks;
+      char *chunkPosition = nullptr;
+      char *chunkEnd = nullptr;
+      MemoryStats memory;
+      bool limitEnforced = true;
+
+      void *allocatePooled(size_t sizeClass);
+      void *allocateBlock(size_t size);
+      void freeBlock(void *block, size_t size);
+      void adopt(void *block);
+      void *reallocateBlock(void *block, size_t oldSize, size_t newSize);
+
+    public:
+      /**
+       * Creates an allocator that fails allocations exceeding `limit` live bytes, raising a lua
+       * memory error. A limit of `0` disables the limit.
+       */
+      explicit PoolAllocator(size_t limit = 0);
+      PoolAllocator(const PoolAllocator &) = delete;
+      PoolAllocator &operator=(const PoolAllocator &) = delete;
+      ~PoolAllocator();
+
+      void setLimit(size_t limit) { memory.limit = limit; }
+
+      /**
+       * Enables or disables the limit without changing it and returns the previous setting.
+       * States only enforce the limit while running lua code called from C++, as memory errors
+       * raised by lua skip the destructors of C++ objects. Values converted by C++ code, such as
+       * arguments and results of native functions, may therefore exceed the limit, which causes
+       * the next allocation of lua code to fail.
+       */
+      bool enforceLimit(bool enforce) {
+        auto previous = limitEnforced;
+        limitEnforced = enforce;
+        return previous;
+      }
+      const MemoryStats &stats() const { return memory; }
+
+      /**
+       * The `lua_Alloc` function, expecting the allocator as user data.
+       */
+      static void *luaAllocate(void *allocator, void *block, size_t oldSize, size_t newSize);
+    };
+
+  }  // namespace lua
+}  // namespace glue
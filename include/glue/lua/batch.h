@@ -0,0 +1,38 @@
+#pragma once
+
+#include <glue/lua/buffer.h>
+
+#include <vector>
+
+namespace glue {
+  namespace lua {
+
+    /**
+     * Arguments for calling a function once per row. Each column is a buffer holding one
+     * argument for every call, so that a batch can reference existing C++ arrays without copying.
+     */
+    class Batch {
+    private:
+      std::vector<Buffer> argumentColumns;
+      size_t rows = 0;
+
+    public:
+      explicit Batch(size_t size = 0) : rows(size) {}
+
+      /**
+       * Appends a column for the next argument. Throws a `std::invalid_argument` error if the
+       * column does not have one element per row.
+       */
+      Batch &addColumn(const Buffer &column);
+
+      const std::vector<Buffer> &columns() const { return argumentColumns; }
+      size_t size() const { return rows; }
+
+      /**
+       * Returns the rows in the range as a batch referencing the same columns.
+       */
+      Batch slice(size_t offset, size_t count) const;
+    };
+
+  }  // namespace lua
+}  // namespace glue
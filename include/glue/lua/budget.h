@@ -0,0 +1,43 @@
+#pragma once
+
+#include <chrono>
+#include <stdexcept>
+
+namespace glue {
+  namespace lua {
+
+    /**
+     * Limits the number of instructions and the time a single call into lua may take.
+     * Budgets are checked every `checkInterval` instructions using a lua count hook, which is
+     * only installed if a limit is set.
+     */
+    struct Budget {
+      enum class Action {
+        /** raise a lua error, reported to C++ as `BudgetExceeded` */
+        Abort,
+        /** yield the coroutine resumed from C++, so that it can be resumed later. Outside of
+            coroutines, exhausted budgets abort. Coroutines created by the script raise the error
+            instead and the resumed coroutine yields at its next check. */
+        Suspend
+      };
+
+      /** the maximum number of instructions or `0` if unlimited */
+      size_t instructions = 0;
+      /** the maximum wall-clock time or `0` if unlimited */
+      std::chrono::nanoseconds time = std::chrono::nanoseconds(0);
+      Action action = Action::Abort;
+      size_t checkInterval = 1000;
+
+      bool isLimited() const { return instructions > 0 || time.count() > 0; }
+    };
+
+    /**
+     * Thrown when a call into lua exceeds its budget.
+     */
+    class BudgetExceeded : public std::runtime_error {
+    public:
+      using std::runtime_error::runtime_error;
+    };
+
+  }  // namespace lua
+}  // namespace glue
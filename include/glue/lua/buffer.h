@@ -0,0 +1,130 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <type_traits>
+#include <vector>
+
+struct lua_State;
+
+namespace glue {
+  namespace lua {
+
+    /**
+     * A typed view of contiguous C++ memory. Buffers are passed to lua as userdata referencing
+     * the memory, so that handing a buffer to lua does not copy its elements. In lua, elements are
+     * accessed in place using one-based indices, `#buffer` returns the number of elements and
+     * `buffer:slice(first, last)` returns a view of the inclusive range.
+     */
+    class Buffer {
+    public:
+      enum class Type { Float32, Float64, Int32, Int64, UInt8 };
+
+      template <class T> static constexpr Type typeOf() {
+        using Element = std::remove_const_t<T>;
+        if constexpr (std::is_same_v<Element, float>) {
+          return Type::Float32;
+        } else if constexpr (std::is_same_v<Element, double>) {
+          return Type::Float64;
+        } else if constexpr (std::is_same_v<Element, int32_t>) {
+          return Type::Int32;
+        } else if constexpr (std::is_same_v<Element, int64_t>) {
+          return Type::Int64;
+        } else if constexpr (std::is_same_v<Element, uint8_t>) {
+          return Type::UInt8;
+        } else {
+          static_assert(sizeof(T) == 0, "unsupported buffer element type");
+        }
+      }
+
+      static size_t elementSize(Type type);
+
+      /**
+       * Returns the name of the element type, e.g. `"float64"`.
+       */
+      static const char *typeName(Type type);
+
+    private:
+      std::shared_ptr<const void> owner;
+      void *elements = nullptr;
+      size_t length = 0;
+      Type elementType = Type::Float64;
+      bool readOnly = false;
+
+    public:
+      Buffer() = default;
+
+      /**
+       * Creates a view of `size` elements starting at `data`. The memory must remain valid as long
+       * as the buffer, or any copy of it, is in use. `owner` is kept alive by all copies and
+       * slices. Buffers of const elements cannot be modified from lua.
+       */
+      template <class T> Buffer(T *data, size_t size, std::shared_ptr<const void> o = nullptr)
+          : owner(std::move(o)),
+            elements(const_cast<std::remove_const_t<T> *>(data)),
+            length(size),
+            elementType(typeOf<T>()),
+            readOnly(std::is_const_v<T>) {}
+
+      /**
+       * Creates a view of the vector's elements which keeps the vector alive.
+       */
+      template <class T> explicit Buffer(std::shared_ptr<std::vector<T>> vector)
+          : Buffer(vector->data(), vector->size(), vector) {}
+
+      Type type() const { return elementType; }
+      size_t size() const { return length; }
+      bool isReadOnly() const { return readOnly; }
+      void *data() const { return elements; }
+
+      /**
+       * Returns the elements as `T *`. Throws a `std::runtime_error` if the type does not match.
+       */
+      template <class T> T *as() const {
+        checkAccess(typeOf<T>(), !std::is_const_v<T>);
+        return static_cast<T *>(elements);
+      }
+
+      /**
+       * Returns a view of `count` elements starting at `offset` sharing the same owner. Throws a
+       * `std::out_of_range` error if the range exceeds the buffer.
+       */
+      Buffer slice(size_t offset, size_t count) const;
+
+    private:
+      void checkAccess(Type type, bool write) const;
+    };
+
+    namespace stack {
+
+      /**
+       * Pushes the buffer as userdata without copying its elements.
+       */
+      void pushBuffer(lua_State *state, const Buffer &buffer);
+
+      /**
+       * Returns the buffer at the stack index or `nullptr` if the value is not a buffer.
+       */
+      Buffer *toBuffer(lua_State *state, int index);
+
+      /**
+       * Pushes the element at `index` of the buffer as a lua number.
+       */
+      void pushBufferElement(lua_State *state, const Buffer &buffer, size_t index);
+
+      /**
+       * Converts the number at the stack index and stores it at `index` of the buffer. Returns
+       * false without modifying the buffer if the value is not a number or cannot be represented
+       * by the element type. Never raises lua errors.
+       */
+      bool toBufferElement(lua_State *state, int valueIndex, const Buffer &buffer, size_t index);
+
+      /**
+       * Creates the metatable used for buffers if it does not exist yet.
+       */
+      void registerBufferMetatable(lua_State *state);
+
+    }  // namespace stack
+
+  }  // namespace lua
+}  // namespace glue
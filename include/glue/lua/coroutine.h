@@ -0,0 +1,74 @@
+#pragma once
+
+#include <glue/context.h>
+#include <glue/lua/budget.h>
+#include <glue/lua/results.h>
+
+#include <memory>
+#include <string>
+
+namespace glue {
+  namespace lua {
+
+    namespace detail {
+      struct CoroutineData;
+    }
+
+    /**
+     * A lua function running as a lua thread of its state. Coroutines are suspended when the
+     * script yields, for example by calling a C++ function returning `Yield`, and continue when
+     * resumed by the host. Suspended coroutines do not occupy an OS thread.
+     * Coroutines may only be resumed from the thread using their state.
+     */
+    class Coroutine {
+    public:
+      enum class Status { Suspended, Running, Done, Error };
+
+    private:
+      std::shared_ptr<detail::CoroutineData> data;
+
+    public:
+      Coroutine() = default;
+      explicit Coroutine(std::shared_ptr<detail::CoroutineData> d) : data(std::move(d)) {}
+
+      /**
+       * Runs the coroutine until it yields or returns and returns the yielded or returned values.
+       * The arguments are passed to the function on the first call and returned from the
+       * yielding call otherwise. Lua errors do not throw but set the status to `Error`.
+       * Throws a `std::runtime_error` if the coroutine is not suspended.
+       */
+      Results resume(const AnyArguments &args = AnyArguments()) const;
+
+      template <class... Args, class = std::enable_if_t<
+                                   !(std::is_same_v<std::decay_t<Args>, AnyArguments> || ...)>>
+      Results resume(Args &&...args) const {
+        AnyArguments arguments;
+        (arguments.push_back(Any(std::forward<Args>(args))), ...);
+        return resume(arguments);
+      }
+
+      Status status() const;
+
+      /**
+       * Returns the error message if the status is `Error`.
+       */
+      const std::string &error() const;
+
+      /**
+       * Sets the budget of each call to `resume`, replacing the budget of the state. Coroutines
+       * exceeding a budget with the `Suspend` action are preempted and can be resumed without
+       * arguments in the next time slice.
+       */
+      void setBudget(const Budget &budget) const;
+
+      /**
+       * Returns true if the last `resume` suspended the coroutine because of its budget.
+       */
+      bool wasPreempted() const;
+
+      bool isSuspended() const { return status() == Status::Suspended; }
+      bool isDone() const { return status() == Status::Done; }
+    };
+
+  }  // namespace lua
+}  // namespace glue
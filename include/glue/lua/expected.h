@@ -0,0 +1,60 @@
+#pragma once
+
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <variant>
+
+namespace glue {
+  namespace lua {
+
+    /**
+     * A lua error returned by the non-throwing `try` functions of a state. The strings are stored
+     * in buffers of the state that are reused by the next failing call, so that reporting errors
+     * does not allocate. Copy them if they are needed for longer.
+     */
+    struct ScriptError {
+      /** the error message, usually prefixed by the location of the error */
+      std::string_view message;
+      /** the stack traceback if enabled using `State::setErrorTracebacks` */
+      std::string_view traceback;
+      /** the chunk name of the innermost lua function at the error or empty if unknown */
+      std::string_view chunk;
+      /** the current line of that function or `-1` if unknown */
+      int line = -1;
+      bool budgetExceeded = false;
+    };
+
+    /**
+     * Holds either a value or the error that prevented computing it.
+     */
+    template <class T> class Expected {
+    private:
+      std::variant<T, ScriptError> data;
+
+    public:
+      Expected(T value) : data(std::in_place_index<0>, std::move(value)) {}
+      Expected(const ScriptError &error) : data(std::in_place_index<1>, error) {}
+
+      bool hasValue() const { return data.index() == 0; }
+      explicit operator bool() const { return hasValue(); }
+
+      /**
+       * Returns the value. Throws a `std::runtime_error` with the error message if there is none.
+       */
+      const T &value() const {
+        if (!hasValue()) {
+          throw std::runtime_error(std::string(error().message));
+        }
+        return std::get<0>(data);
+      }
+
+      const T &operator*() const { return std::get<0>(data); }
+      const T *operator->() const { return &std::get<0>(data); }
+
+      const ScriptError &error() const { return std::get<1>(data); }
+    };
+
+  }  // namespace lua
+}  // namespace glue
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+
+namespace glue {
+  namespace lua {
+
+    /**
+     * Parameters of lua's incremental collector. Zero keeps the current value.
+     */
+    struct IncrementalGC {
+      /** percentage the heap may grow after a collection before a new cycle starts */
+      int pause = 0;
+      /** speed of the collector relative to allocation, as a percentage */
+      int stepMultiplier = 0;
+      /** log2 of the number of kilobytes allocated between steps */
+      int stepSize = 0;
+    };
+
+    /**
+     * Parameters of lua's generational collector. Zero keeps the current value.
+     */
+    struct GenerationalGC {
+      /** percentage the heap may grow beyond its size after a major collection before a minor
+          collection runs */
+      int minorMultiplier = 0;
+      /** percentage the heap may grow before a major collection runs */
+      int majorMultiplier = 0;
+    };
+
+    /**
+     * Statistics of collections started through the state. Automatic collections triggered by
+     * allocations and collections started by scripts are not measured.
+     */
+    struct GCStats {
+      size_t fullCollections = 0;
+      size_t steps = 0;
+      /** the number of cycles finished by steps, including minor collections */
+      size_t completedCycles = 0;
+      /** heap size in bytes before and after the last collection or step */
+      size_t heapBefore = 0;
+      size_t heapAfter = 0;
+      std::chrono::nanoseconds lastPause = std::chrono::nanoseconds(0);
+      std::chrono::nanoseconds maxPause = std::chrono::nanoseconds(0);
+      std::chrono::nanoseconds totalPause = std::chrono::nanoseconds(0);
+    };
+
+  }  // namespace lua
+}  // namespace glue
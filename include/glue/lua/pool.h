@@ -0,0 +1,85 @@
+#pragma once
+
+#include <glue/lua/state.h>
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+namespace glue {
+  namespace lua {
+
+    /**
+     * Runs jobs on a fixed number of worker threads, each owning a lua state created by the same
+     * initializer. Every worker has its own job queue and idle workers steal jobs from the others,
+     * so that submitting jobs does not contend on a single lock.
+     */
+    class StatePool {
+    public:
+      using Initializer = std::function<void(State &)>;
+      using Job = std::function<void(State &)>;
+
+    private:
+      struct Worker;
+
+      std::vector<std::unique_ptr<Worker>> workers;
+      std::atomic<size_t> nextWorker{0};
+      std::atomic<size_t> pending{0};
+      std::atomic<size_t> sleeping{0};
+      std::mutex sleepMutex;
+      std::condition_variable wakeUp;
+      bool stopping = false;
+
+      void post(Job job);
+      bool takeJob(size_t index, Job &job);
+      void run(size_t index);
+
+    public:
+      /**
+       * Creates `size` states, calls `initialize` for each of them and starts one worker thread
+       * per state. Exceptions thrown by `initialize` are propagated.
+       */
+      explicit StatePool(const Initializer &initialize,
+                         size_t size = std::max(1u, std::thread::hardware_concurrency()));
+      StatePool(const StatePool &) = delete;
+      StatePool &operator=(const StatePool &) = delete;
+
+      /**
+       * Finishes all submitted jobs before stopping the workers.
+       */
+      ~StatePool();
+
+      size_t size() const { return workers.size(); }
+
+      /**
+       * Runs `job(state)` on one of the worker states and returns a future for its result.
+       * Exceptions thrown by the job are stored in the future. Lua values returned by the job
+       * belong to the worker's state and must not be used outside of the pool's jobs.
+       */
+      template <class F> auto submit(F &&job) -> std::future<std::invoke_result_t<F &, State &>> {
+        using Result = std::invoke_result_t<F &, State &>;
+        auto task = std::make_shared<std::packaged_task<Result(State &)>>(std::forward<F>(job));
+        auto future = task->get_future();
+        post([task](State &state) { (*task)(state); });
+        return future;
+      }
+
+      /**
+       * Splits the batch into one slice per worker and calls the lua function returned by the
+       * expression `function` in each worker's state for the rows of its slice, as in
+       * `State::callBatch`. Blocks until all rows are done and rethrows the first error.
+       * Must not be called from a job of the same pool.
+       */
+      void callBatch(const std::string &function, const Batch &batch, const Buffer &results);
+    };
+
+  }  // namespace lua
+}  // namespace glue
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <chrono>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace glue {
+  namespace lua {
+
+    struct ProfilerOptions {
+      /** the number of lua instructions between samples */
+      size_t interval = 10000;
+      /** the maximum number of frames recorded per sample */
+      size_t maxDepth = 64;
+    };
+
+    struct FunctionProfile {
+      std::string name;
+      /** time spent in the function itself */
+      std::chrono::nanoseconds selfTime = std::chrono::nanoseconds(0);
+      /** time spent in the function including its callees */
+      std::chrono::nanoseconds totalTime = std::chrono::nanoseconds(0);
+    };
+
+    /**
+     * Time spent in each sampled call stack. Frames are named `name (source:line)` for lua
+     * functions, `[native] name` for functions bound from C++ and `[C] name` for other C
+     * functions. Time spent inside native functions is measured for each call and, like time
+     * spent in lua, attributed to the stack of the next sample.
+     */
+    struct Profile {
+      /** stacks of frame names separated by `;`, starting at the outermost frame */
+      std::map<std::string, std::chrono::nanoseconds> stacks;
+      size_t samples = 0;
+
+      /**
+       * Returns the stacks in the folded format used by flamegraph tools, with the time given in
+       * microseconds.
+       */
+      std::string foldedStacks() const;
+
+      /**
+       * Returns the self and total times of each function, ordered by decreasing self time.
+       */
+      std::vector<FunctionProfile> functions() const;
+    };
+
+  }  // namespace lua
+}  // namespace glue
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <glue/context.h>
+
+#include <array>
+#include <initializer_list>
+#include <stdexcept>
+#include <vector>
+
+namespace glue {
+  namespace lua {
+
+    /**
+     * A list of values passed to or returned from lua functions. Up to `inlineCapacity` values
+     * are stored inline, so that functions with few results do not allocate.
+     * Returning `Results` from a function called by lua returns each value separately.
+     */
+    class Results {
+    public:
+      static constexpr size_t inlineCapacity = 4;
+
+    private:
+      std::array<Any, inlineCapacity> inlineValues;
+      std::vector<Any> additionalValues;
+      size_t count = 0;
+
+    public:
+      Results() = default;
+
+      Results(std::initializer_list<Any> values) {
+        for (auto &value : values) {
+          push_back(value);
+        }
+      }
+
+      size_t size() const { return count; }
+      bool empty() const { return count == 0; }
+
+      void push_back(Any value) {
+        if (count < inlineCapacity) {
+          inlineValues[count] = std::move(value);
+        } else {
+          additionalValues.push_back(std::move(value));
+        }
+        ++count;
+      }
+
+      void clear() {
+        for (size_t i = 0; i < count && i < inlineCapacity; ++i) {
+          inlineValues[i] = Any();
+        }
+        additionalValues.clear();
+        count = 0;
+      }
+
+      const Any &operator[](size_t index) const {
+        return index < inlineCapacity ? inlineValues[index]
+                                      : additionalValues[index - inlineCapacity];
+      }
+
+      Any &operator[](size_t index) {
+        return index < inlineCapacity ? inlineValues[index]
+                                      : additionalValues[index - inlineCapacity];
+      }
+
+      /**
+       * Returns the value at `index`. Throws a `std::out_of_range` error if there is no such value.
+       */
+      const Any &at(size_t index) const {
+        if (index >= count) {
+          throw std::out_of_range("result index out of range");
+        }
+        return (*this)[index];
+      }
+
+      template <class T> T get(size_t index) const { return at(index).template get<T>(); }
+    };
+
+    /**
+     * Returned from a function called by a coroutine to suspend the coroutine. `values` are
+     * returned by `Coroutine::resume` and the arguments of the next `resume` are returned to the
+     * script.
+     */
+    struct Yield {
+      Results values;
+    };
+
+  }  // namespace lua
+}  // namespace glue
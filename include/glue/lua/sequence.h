@@ -0,0 +1,57 @@
+#pragma once
+
+#include <glue/context.h>
+
+#include <string>
+#include <vector>
+
+namespace glue {
+  namespace lua {
+
+    namespace detail {
+      struct LuaMap;
+    }
+
+    /**
+     * An indexable view of a lua array table. Indices are zero-based on the C++ side and
+     * correspond to the lua indices `1` to `size()`.
+     */
+    class Sequence {
+    private:
+      Value value;
+      const detail::LuaMap *table;
+
+    public:
+      /**
+       * Creates a view of the lua table contained in `value`. Throws a `std::runtime_error` if
+       * the value is not a lua table.
+       */
+      explicit Sequence(const Value &value);
+
+      /**
+       * Returns the length of the sequence as defined by the lua length operator without
+       * metamethods.
+       */
+      size_t size() const;
+
+      Any get(size_t index) const;
+      Any operator[](size_t index) const { return get(index); }
+      void set(size_t index, const Any &element) const;
+
+      /**
+       * Copies all elements into the target in a single pass. Throws a `std::runtime_error` if an
+       * element has an unexpected type.
+       */
+      void read(std::vector<double> &target) const;
+      void read(std::vector<int64_t> &target) const;
+      void read(std::vector<std::string> &target) const;
+
+      template <class T> std::vector<T> toVector() const {
+        std::vector<T> result;
+        read(result);
+        return result;
+      }
+    };
+
+  }  // namespace lua
+}  // namespace glue
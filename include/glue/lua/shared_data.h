@@ -0,0 +1,93 @@
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <variant>
+#include <vector>
+
+struct lua_State;
+
+namespace glue {
+  namespace lua {
+
+    /**
+     * An immutable tree of plain values that can be shared by any number of lua states and
+     * threads. Arrays and tables are passed to lua as read-only userdata proxies that read
+     * directly from the shared tree, so each state only holds the proxies it accesses.
+     * In lua, proxies support indexing, `#` and `pairs`. Arrays use one-based indices and
+     * tables are iterated in key order.
+     */
+    class SharedData {
+    public:
+      enum class Type { Nil, Boolean, Integer, Number, String, Array, Table };
+
+      using Array = std::vector<SharedData>;
+      using Table = std::map<std::string, SharedData, std::less<>>;
+
+    private:
+      using Node
+          = std::variant<std::monostate, bool, int64_t, double, std::string, Array, Table>;
+
+      std::shared_ptr<const Node> node;
+
+      template <class T> explicit SharedData(std::in_place_type_t<T>, T value)
+          : node(std::make_shared<const Node>(std::in_place_type<T>, std::move(value))) {}
+
+    public:
+      SharedData() = default;
+      SharedData(bool value) : SharedData(std::in_place_type<bool>, value) {}
+      SharedData(int value) : SharedData(std::in_place_type<int64_t>, int64_t(value)) {}
+      SharedData(int64_t value) : SharedData(std::in_place_type<int64_t>, value) {}
+      SharedData(double value) : SharedData(std::in_place_type<double>, value) {}
+      SharedData(std::string value)
+          : SharedData(std::in_place_type<std::string>, std::move(value)) {}
+      SharedData(const char *value) : SharedData(std::string(value)) {}
+      SharedData(Array value) : SharedData(std::in_place_type<Array>, std::move(value)) {}
+      SharedData(Table value) : SharedData(std::in_place_type<Table>, std::move(value)) {}
+
+      Type type() const { return node ? Type(node->index()) : Type::Nil; }
+
+      bool asBoolean() const { return std::get<bool>(*node); }
+      int64_t asInteger() const { return std::get<int64_t>(*node); }
+      double asNumber() const;
+      const std::string &asString() const { return std::get<std::string>(*node); }
+      const Array &asArray() const { return std::get<Array>(*node); }
+      const Table &asTable() const { return std::get<Table>(*node); }
+
+      /**
+       * Returns the number of elements of arrays and tables or `0` for other values.
+       */
+      size_t size() const;
+
+      /**
+       * Returns the table entry for `key` or nil if there is no such entry or the value is not a
+       * table.
+       */
+      SharedData operator[](std::string_view key) const;
+
+      /**
+       * Returns true if both refer to the same node of a tree.
+       */
+      bool isSame(const SharedData &other) const { return node == other.node; }
+    };
+
+    namespace stack {
+
+      /**
+       * Pushes plain values as lua values and arrays and tables as read-only proxies.
+       */
+      void pushSharedData(lua_State *state, const SharedData &data);
+
+      /**
+       * Returns the shared data referenced by a proxy at the stack index or `nullptr` if the value
+       * is not a proxy.
+       */
+      SharedData *toSharedData(lua_State *state, int index);
+
+    }  // namespace stack
+
+  }  // namespace lua
+}  // namespace glue
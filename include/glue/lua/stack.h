@@ -0,0 +1,230 @@
+#pragma once
+
+#include <glue/context.h>
+#include <glue/lua/results.h>
+#include <glue/lua/string_ref.h>
+
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+struct lua_State;
+
+namespace glue {
+  namespace lua {
+    namespace stack {
+
+      /**
+       * Reads values from the lua stack. Throws a `std::runtime_error` if the value has the wrong
+       * type. Returned string views are valid as long as the value remains on the stack.
+       */
+      bool getBoolean(lua_State *state, int index);
+      int64_t getInteger(lua_State *state, int index);
+      double getNumber(lua_State *state, int index);
+      std::string_view getString(lua_State *state, int index);
+      Any getAny(lua_State *state, int index);
+
+      /**
+       * Reads an integer and throws a `std::runtime_error` if it is outside of `[min, max]`.
+       */
+      int64_t getInteger(lua_State *state, int index, int64_t min, int64_t max);
+
+      /**
+       * Reads all values from `index` to the top of the stack. Used as the last parameter of a
+       * typed function, it receives all remaining arguments.
+       */
+      Results getResults(lua_State *state, int index);
+
+      /**
+       * Pushes values onto the lua stack.
+       */
+      void pushNil(lua_State *state);
+      void pushBoolean(lua_State *state, bool value);
+      void pushInteger(lua_State *state, int64_t value);
+      void pushNumber(lua_State *state, double value);
+      void pushString(lua_State *state, const std::string_view &value);
+      void pushAny(lua_State *state, const Any &value);
+
+      /**
+       * Pushes each value separately and returns the number of values pushed.
+       */
+      int pushResults(lua_State *state, const Results &values);
+
+      /**
+       * Added to the result count returned by an invoker to yield the results from the running
+       * coroutine instead of returning them.
+       */
+      constexpr int yieldMarker = 1 << 24;
+
+      /**
+       * Pushes the yielded values and returns the marked result count.
+       */
+      inline int pushYield(lua_State *state, const Yield &yield) {
+        return pushResults(state, yield.values) + yieldMarker;
+      }
+
+      /**
+       * Pops the value on top of the stack and returns it as `Any`.
+       */
+      Any pop(lua_State *state);
+
+      /**
+       * Pops the value on top of the stack and assigns it to the global variable `name`.
+       */
+      void setGlobal(lua_State *state, const std::string &name);
+
+      using Invoker = int (*)(void *function, lua_State *state);
+      using Deleter = void (*)(void *function);
+
+      /**
+       * Pushes a lua function that calls `invoke(function, state)` and returns the number of
+       * results pushed, or yields them if the count is marked using `yieldMarker`. The state takes
+       * ownership of `function` and releases it using `deleter`. Exceptions thrown by `invoke` are
+       * converted to lua errors.
+       */
+      void pushFunction(lua_State *state, void *function, Invoker invoke, Deleter deleter);
+
+      /**
+       * Reads the value as `T`. Values are always returned by value, so that parameters taken by
+       * const reference bind to a temporary living until the call returns.
+       */
+      template <class T> auto get(lua_State *state, int index) {
+        using Value = std::decay_t<T>;
+        static_assert(
+            !std::is_lvalue_reference_v<T> || std::is_const_v<std::remove_reference_t<T>>,
+            "typed functions cannot take non-const references");
+        if constexpr (std::is_same_v<Value, bool>) {
+          return getBoolean(state, index);
+        } else if constexpr (std::is_integral_v<Value>) {
+          if constexpr (std::is_same_v<Value, int64_t>) {
+            return getInteger(state, index);
+          } else {
+            // lua integers are 64 bit signed, so larger unsigned values cannot occur
+            constexpr auto min = int64_t(std::numeric_limits<Value>::min());
+            constexpr auto max = std::numeric_limits<Value>::max();
+            constexpr auto upper = uint64_t(max) > uint64_t(std::numeric_limits<int64_t>::max())
+                                       ? std::numeric_limits<int64_t>::max()
+                                       : int64_t(max);
+            return static_cast<Value>(getInteger(state, index, min, upper));
+          }
+        } else if constexpr (std::is_floating_point_v<Value>) {
+          return static_cast<Value>(getNumber(state, index));
+        } else if constexpr (std::is_same_v<Value, std::string_view>) {
+          return getString(state, index);
+        } else if constexpr (std::is_same_v<Value, std::string>) {
+          return std::string(getString(state, index));
+        } else if constexpr (std::is_same_v<Value, Any>) {
+          return getAny(state, index);
+        } else if constexpr (std::is_same_v<Value, Results>) {
+          return getResults(state, index);
+        } else if constexpr (std::is_same_v<Value, StringRef>) {
+          return getStringRef(state, index);
+        } else {
+          return getAny(state, index).template get<Value>();
+        }
+      }
+
+      template <class T> void push(lua_State *state, T &&value) {
+        using Value = std::decay_t<T>;
+        if constexpr (std::is_same_v<Value, bool>) {
+          pushBoolean(state, value);
+        } else if constexpr (std::is_integral_v<Value>) {
+          pushInteger(state, static_cast<int64_t>(value));
+        } else if constexpr (std::is_floating_point_v<Value>) {
+          pushNumber(state, static_cast<double>(value));
+        } else if constexpr (std::is_same_v<Value, StringRef>) {
+          // pushes the referenced lua string without copying
+          pushAny(state, Any(value));
+        } else if constexpr (std::is_convertible_v<const Value &, std::string_view>) {
+          pushString(state, std::string_view(value));
+        } else if constexpr (std::is_same_v<Value, Any>) {
+          pushAny(state, value);
+        } else {
+          pushAny(state, Any(std::forward<T>(value)));
+        }
+      }
+
+      namespace detail {
+        template <class T> struct IsTuple : std::false_type {};
+        template <class... Args> struct IsTuple<std::tuple<Args...>> : std::true_type {};
+      }  // namespace detail
+
+      /**
+       * Pushes the value and returns the number of values pushed. `Results` and tuples are pushed
+       * as multiple values and `Yield` returns a marked result count.
+       */
+      template <class T> int pushAll(lua_State *state, T &&value) {
+        using Value = std::decay_t<T>;
+        if constexpr (std::is_same_v<Value, Results>) {
+          return pushResults(state, value);
+        } else if constexpr (std::is_same_v<Value, Yield>) {
+          return pushYield(state, value);
+        } else if constexpr (detail::IsTuple<Value>::value) {
+          std::apply([state](auto &&...values) { (push(state, values), ...); }, value);
+          return int(std::tuple_size_v<Value>);
+        } else {
+          push(state, std::forward<T>(value));
+          return 1;
+        }
+      }
+
+      namespace detail {
+
+        template <class T> struct FunctionTraits
+            : public FunctionTraits<decltype(&std::decay_t<T>::operator())> {};
+
+        template <class R, class... Args> struct FunctionTraits<R (*)(Args...)> {
+          using Result = R;
+          using Arguments = std::tuple<Args...>;
+        };
+
+        template <class C, class R, class... Args> struct FunctionTraits<R (C::*)(Args...)>
+            : public FunctionTraits<R (*)(Args...)> {};
+
+        template <class C, class R, class... Args> struct FunctionTraits<R (C::*)(Args...) const>
+            : public FunctionTraits<R (*)(Args...)> {};
+
+        template <class F, class R, class... Args, size_t... I>
+        int call(F &f, lua_State *state, std::tuple<Args...> *, std::index_sequence<I...>) {
+          (void)state;
+          if constexpr (std::is_void_v<R>) {
+            f(get<Args>(state, int(I) + 1)...);
+            return 0;
+          } else {
+            return pushAll(state, f(get<Args>(state, int(I) + 1)...));
+          }
+        }
+
+        template <class F> int invoke(void *function, lua_State *state) {
+          using Traits = FunctionTraits<F>;
+          using Arguments = typename Traits::Arguments;
+          return call<F, typename Traits::Result>(
+              *static_cast<F *>(function), state, static_cast<Arguments *>(nullptr),
+              std::make_index_sequence<std::tuple_size_v<Arguments>>());
+        }
+
+        template <class F> void destroy(void *function) { delete static_cast<F *>(function); }
+
+      }  // namespace detail
+
+      /**
+       * Pushes a lua function that calls `f` with arguments read directly from the lua stack,
+       * using the signature of `f` known at compile time. Returned `Results` or tuples are
+       * returned as multiple values and a trailing `Results` parameter receives all remaining
+       * arguments.
+       */
+      template <class F> void pushFunction(lua_State *state, F &&f) {
+        using Function = std::decay_t<F>;
+        auto function = std::make_unique<Function>(std::forward<F>(f));
+        pushFunction(state, function.get(), &detail::invoke<Function>, &detail::destroy<Function>);
+        function.release();
+      }
+
+    }  // namespace stack
+  }    // namespace lua
+}  // namespace glue
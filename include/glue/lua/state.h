@@ -1,6 +1,23 @@
 #pragma once
 
 #include <glue/context.h>
+#include <glue/lua/allocator.h>
+#include <glue/lua/batch.h>
+#include <glue/lua/budget.h>
+#include <glue/lua/buffer.h>
+#include <glue/lua/coroutine.h>
+#include <glue/lua/expected.h>
+#include <glue/lua/gc.h>
+#include <glue/lua/profiler.h>
+#include <glue/lua/results.h>
+#include <glue/lua/sequence.h>
+#include <glue/lua/shared_data.h>
+#include <glue/lua/stack.h>
+#include <glue/lua/stats.h>
+#include <glue/lua/string_ref.h>
+
+#include <cstring>
+#include <type_traits>
 
 struct lua_State;
 
@@ -8,6 +25,49 @@ namespace glue {
   namespace lua {
 
     struct Data;
+    class State;
+
+    /**
+     * A compiled chunk of lua code that can be run repeatedly without being parsed again.
+     * Chunks may only be run by the state that compiled them. Running them in another state
+     * throws a `std::invalid_argument` error.
+     */
+    class Chunk {
+    private:
+      friend class State;
+      Value function;
+      lua_State *owner = nullptr;
+      Chunk(Value f, lua_State *o) : function(std::move(f)), owner(o) {}
+
+    public:
+      Chunk() = default;
+    };
+
+    /**
+     * Usage statistics of the compiled chunk cache.
+     */
+    struct ChunkCacheStats {
+      size_t hits = 0;
+      size_t misses = 0;
+      size_t evictions = 0;
+      size_t size = 0;
+      size_t capacity = 0;
+    };
+
+    /**
+     * Copies values of a trivially copyable class into and out of lua userdata.
+     */
+    struct InlineType {
+      size_t size = 0;
+      /** copies the value to `target` and returns true if it has the type */
+      bool (*store)(const Any &value, void *target) = nullptr;
+      Any (*load)(const void *source) = nullptr;
+    };
+
+    /**
+     * Determines when the entries of a module are converted to lua values.
+     */
+    enum class ModuleLoading { Eager, Lazy };
 
     class State {
     private:
@@ -19,7 +79,19 @@ namespace glue {
        * Create a new lua state and destroys the state after use.
        */
       State();
+
+      /**
+       * Wraps an existing lua state. The extra space of the state (see `lua_getextraspace`) is
+       * used to find LuaGlue's data, so it must not be used otherwise. Coroutines created before
+       * the state is first wrapped cannot call into C++.
+       */
       State(lua_State *existing);
+
+      /**
+       * Creates a new lua state that allocates all memory using `allocator`. The allocator may
+       * only be used by one state.
+       */
+      explicit State(std::shared_ptr<PoolAllocator> allocator);
       State(const State &other) = delete;
 
       /**
@@ -27,26 +99,198 @@ namespace glue {
        */
       Value runFile(const std::string &path) const;
 
+      /**
+       * Enables caching of compiled bytecode for `runFile` in the given directory.
+       * Files are read and hashed on every run and only recompiled if their content has changed.
+       * The directory may be shared by multiple processes, but it must be trusted: lua does not
+       * verify bytecode, so anyone able to write to it can run arbitrary code or crash the
+       * process. An empty path disables the cache.
+       */
+      void setBytecodeCacheDirectory(const std::string &path) const;
+
+      /**
+       * Sets the budget for each subsequent call into lua using `run`, `runFile` and `call` and
+       * each `resume` of coroutines without their own budget. A default budget removes all limits.
+       */
+      void setBudget(const Budget &budget) const;
+
       /**
        * Runs the code and returns the returned result as a `Any`.
        */
       Value run(const std::string_view &code, const std::string &name = "anonymous lua code") const;
 
       /**
-       * Runs the expression and returns the result as a `Any`
+       * Runs a previously compiled chunk and returns the returned result as a `Any`.
+       */
+      Value run(const Chunk &chunk) const;
+
+      /**
+       * Compiles the code into a chunk that can be run repeatedly using `run`.
+       */
+      Chunk compile(const std::string_view &code,
+                    const std::string &name = "anonymous lua code") const;
+
+      /**
+       * Creates a suspended coroutine running the function or chunk when first resumed.
+       */
+      Coroutine createCoroutine(const Value &function) const;
+      Coroutine createCoroutine(const Chunk &chunk) const;
+
+      /**
+       * Sets the maximum number of compiled chunks cached by `run` and `get`.
+       * Least recently used chunks are evicted first. A capacity of `0` disables the cache.
+       */
+      void setChunkCacheCapacity(size_t capacity) const;
+
+      /**
+       * Removes all compiled chunks from the cache.
+       */
+      void clearChunkCache() const;
+
+      /**
+       * Returns the hit and miss counters of the chunk cache.
+       */
+      ChunkCacheStats chunkCacheStats() const;
+
+      /**
+       * Calls the function and returns all of its results. Lua functions are called in protected
+       * mode, errors are rethrown as `std::runtime_error`.
+       */
+      Results call(const Value &function, const AnyArguments &args) const;
+
+      template <class... Args, class = std::enable_if_t<
+                                   !(std::is_same_v<std::decay_t<Args>, AnyArguments> || ...)>>
+      Results call(const Value &function, Args &&...args) const {
+        AnyArguments arguments;
+        (arguments.push_back(Any(std::forward<Args>(args))), ...);
+        return call(function, arguments);
+      }
+
+      /**
+       * Runs the code like `run`, but returns lua errors instead of throwing them. Runtime errors
+       * are reported without allocating once the error buffers of the state are large enough.
+       */
+      Expected<Value> tryRun(const std::string_view &code,
+                             const std::string &name = "anonymous lua code") const;
+
+      /**
+       * Calls the function like `call`, but returns errors instead of throwing them. Only lua
+       * functions are called without exceptions; other functions are called using `call` and
+       * exceptions thrown by them are caught and returned.
+       */
+      Expected<Results> tryCall(const Value &function, const AnyArguments &args) const;
+
+      template <class... Args, class = std::enable_if_t<
+                                   !(std::is_same_v<std::decay_t<Args>, AnyArguments> || ...)>>
+      Expected<Results> tryCall(const Value &function, Args &&...args) const {
+        AnyArguments arguments;
+        (arguments.push_back(Any(std::forward<Args>(args))), ...);
+        return tryCall(function, arguments);
+      }
+
+      /**
+       * If enabled, errors returned by `tryRun` and `tryCall` include a stack traceback.
+       */
+      void setErrorTracebacks(bool enabled) const;
+
+      /**
+       * Calls the lua function once for each row of the batch and stores the first result of
+       * each call in `results`, which needs one writable element per row. The function and
+       * arguments are pushed directly from the buffers without creating intermediate values.
+       * Throws a `std::runtime_error` if a call fails or returns a value that is not a number or
+       * cannot be represented by the element type of `results`.
        */
-      Value get(const std::string &value) const { return run("return " + value); }
+      void callBatch(const Value &function, const Batch &batch, const Buffer &results) const;
+
+      /**
+       * Calls the lua function for each row of the batch and returns the results as numbers.
+       */
+      std::vector<double> callBatch(const Value &function, const Batch &batch) const;
+
+      /**
+       * Runs the expression and returns the result as a `Any`. The expression shares its cache
+       * entry with `run("return " + value)`.
+       */
+      Value get(const std::string &value) const;
 
       /**
        * Runs the code and returns the result as `T`
        */
       template <class T> T get(const std::string &code) const { return get(code)->get<T>(); }
 
+      /**
+       * Returns the boundary stats collected since the state was created or `resetStats` was
+       * called. All counters are zero unless stats are enabled at build time.
+       */
+      BoundaryStats stats() const;
+
+      void resetStats() const;
+
+      /**
+       * Starts sampling the call stacks of lua code running in the state, replacing the previous
+       * profile. Lua has no timer hooks, so samples are taken every `options.interval`
+       * instructions and weighted by the time passed since the previous sample. Calls of
+       * functions bound from C++ are timed individually and attributed to the next sample.
+       * Hooks installed by the application remain active and are restored when profiling
+       * stops.
+       */
+      void startProfiler(const ProfilerOptions &options = ProfilerOptions()) const;
+
+      void stopProfiler() const;
+
+      bool isProfiling() const;
+
+      /**
+       * Returns the profile recorded since the last call to `startProfiler`.
+       */
+      Profile profile() const;
+
+      /**
+       * Returns the memory usage of the state. If the state does not use a `PoolAllocator`, only
+       * `liveBytes` is set.
+       */
+      MemoryStats memoryStats() const;
+
       /**
        * Runs lua garbage collector
        */
       void collectGarbage() const;
 
+      /**
+       * Switches to the incremental collector, which is lua's default.
+       */
+      void setIncrementalGC(const IncrementalGC &parameters = IncrementalGC()) const;
+
+      /**
+       * Switches to the generational collector, which usually has shorter pauses for programs
+       * creating many short-lived objects.
+       */
+      void setGenerationalGC(const GenerationalGC &parameters = GenerationalGC()) const;
+
+      /**
+       * Stops or restarts automatic collection. Explicit collections and steps also run while
+       * automatic collection is stopped.
+       */
+      void setGCRunning(bool running) const;
+
+      bool isGCRunning() const;
+
+      /**
+       * Runs collection steps until the time budget is used up or the current cycle is finished.
+       * Returns true if a cycle was finished. In generational mode, a single minor collection is
+       * run and counted as a finished cycle. Modes switched by scripts through `collectgarbage`
+       * are detected, while switches bypassing the standard library are not.
+       */
+      bool collectGarbageStep(std::chrono::nanoseconds budget) const;
+
+      /**
+       * Runs a collection step doing work corresponding to allocating `kilobytes`. Returns true if
+       * a cycle was finished, which is always the case in generational mode.
+       */
+      bool collectGarbageStep(size_t kilobytes) const;
+
+      GCStats gcStats() const;
+
       /**
        * Opens the lua standard libraries
        */
@@ -58,10 +302,82 @@ namespace glue {
       MapValue root() const;
 
       /**
-       * adds a module to the target map and registers all contained classes
+       * adds a module to the target map and registers all contained classes.
+       * Lazy modules convert entries on first access, and their classes once they are accessed
+       * or an instance of an unregistered class is converted. Entries already present in a lua
+       * target take precedence over the module. Keys not
+       * found in a lazy module are remembered, so entries added to the module after they were
+       * looked up are only visible after adding another module to the target.
+       */
+      void addModule(const MapValue &map, const MapValue &target,
+                     ModuleLoading loading = ModuleLoading::Eager);
+      void addModule(const MapValue &map, ModuleLoading loading = ModuleLoading::Eager) {
+        return addModule(map, root(), loading);
+      }
+
+      /**
+       * If enabled, C++ maps passed to lua are converted once and the same table is reused
+       * whenever the same map is passed again. Tables are held weakly and keep their map alive.
+       * Changes to a map are not visible in lua until it is invalidated using `invalidateMap`.
+       */
+      void setMapIdentityCache(bool enabled) const;
+
+      /**
+       * Converts the map to a new table the next time it is passed to lua.
+       */
+      void invalidateMap(const MapValue &map) const;
+
+      /** the maximum size of classes stored inline */
+      static constexpr size_t maxInlineSize = 32;
+
+      /**
+       * Stores instances of the registered class `T` directly in lua userdata instead of in a
+       * shared `Any`, which saves an allocation and the finalizer of every object. Inline values
+       * are copied whenever they are passed to C++, so methods modifying the value have no
+       * effect on the lua object. Meant for immutable value types such as vectors and enums.
+       */
+      template <class T> void addInlineType() const {
+        static_assert(std::is_trivially_copyable_v<T>, "inline types must be trivially copyable");
+        static_assert(sizeof(T) <= maxInlineSize, "inline type too large");
+        static_assert(alignof(T) <= alignof(double), "inline type alignment too large");
+        InlineType type;
+        type.size = sizeof(T);
+        type.store = [](const Any &value, void *target) {
+          struct Visitor : revisited::RecursiveVisitor<const T &> {
+            void *target = nullptr;
+            bool visit(const T &v) override {
+              std::memcpy(target, &v, sizeof(T));
+              return true;
+            }
+          } visitor;
+          visitor.target = target;
+          return value.accept(visitor);
+        };
+        type.load = [](const void *source) { return Any(*static_cast<const T *>(source)); };
+        addInlineType(type);
+      }
+
+      void addInlineType(const InlineType &type) const;
+
+      /**
+       * Creates a lua function that reads its arguments directly from the lua stack and pushes
+       * its result directly, using the signature of `f` known at compile time. Primitives and
+       * strings are not converted to `Any`, avoiding the overhead of type-erased functions.
+       */
+      template <class F> Value createFunction(F &&f) const {
+        auto state = getRawLuaState();
+        stack::pushFunction(state, std::forward<F>(f));
+        return stack::pop(state);
+      }
+
+      /**
+       * Assigns a function created by `createFunction` to the global variable `name`.
        */
-      void addModule(const MapValue &map, const MapValue &target);
-      void addModule(const MapValue &map) { return addModule(map, root()); }
+      template <class F> void bind(const std::string &name, F &&f) const {
+        auto state = getRawLuaState();
+        stack::pushFunction(state, std::forward<F>(f));
+        stack::setGlobal(state, name);
+      }
 
       /**
        * returns a pointer to the internal lua state
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <glue/lua/state.h>
+
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace glue {
+  namespace lua {
+
+    /**
+     * Records the steps for setting up a state once, so that new states can be created from it
+     * quickly. Bootstrap scripts are compiled to bytecode when they are added and modules are
+     * added lazily by default, so creating a state neither parses code nor converts module
+     * entries that are never accessed.
+     * Templates are immutable while creating states and may be used from multiple threads.
+     */
+    class StateTemplate {
+    private:
+      struct Step {
+        bool standardLibs = false;
+        MapValue module;
+        ModuleLoading loading = ModuleLoading::Lazy;
+        std::string bytecode;
+        std::string name;
+      };
+
+      std::vector<Step> steps;
+
+    public:
+      StateTemplate &openStandardLibs();
+
+      StateTemplate &addModule(const MapValue &map, ModuleLoading loading = ModuleLoading::Lazy);
+
+      /**
+       * Compiles the script, which is run when initializing states. Throws a `std::runtime_error`
+       * on syntax errors.
+       */
+      StateTemplate &run(const std::string_view &code, const std::string &name = "bootstrap");
+
+      /**
+       * Applies all steps to the state in the order they were added. Errors raised by scripts are
+       * rethrown as `std::runtime_error`. Can be used as the initializer of a `StatePool`.
+       */
+      void initialize(State &state) const;
+
+      /**
+       * Creates a new state and initializes it from the template.
+       */
+      std::unique_ptr<State> create(std::shared_ptr<PoolAllocator> allocator = nullptr) const;
+    };
+
+  }  // namespace lua
+}  // namespace glue
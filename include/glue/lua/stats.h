@@ -0,0 +1,58 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+
+namespace glue {
+  namespace lua {
+
+    /** lua value types in the order of the lua type constants */
+    enum class LuaType {
+      Nil,
+      Boolean,
+      LightUserdata,
+      Number,
+      String,
+      Table,
+      Function,
+      Userdata,
+      Thread,
+      Count
+    };
+
+    /**
+     * Counts values and calls crossing the boundary between C++ and lua. Counters are only
+     * updated if LuaGlue is built with the `LUA_GLUE_ENABLE_STATS` CMake option, otherwise they
+     * are compiled out and remain zero.
+     */
+    struct BoundaryStats {
+#ifdef LUA_GLUE_ENABLE_STATS
+      static constexpr bool enabled = true;
+#else
+      static constexpr bool enabled = false;
+#endif
+
+      using TypeCounts = std::array<size_t, size_t(LuaType::Count)>;
+
+      /** calls of lua functions from C++ */
+      size_t callsIntoLua = 0;
+      /** calls of C++ functions from lua */
+      size_t callsFromLua = 0;
+      /** values converted from C++ to lua by resulting lua type, including nested values */
+      TypeCounts valuesToLua{};
+      /** values converted from lua to C++ by lua type */
+      TypeCounts valuesFromLua{};
+      /** C++ maps copied into new lua tables */
+      size_t tablesCopied = 0;
+      /** class instances created through the context */
+      size_t instancesCreated = 0;
+      /** total time spent converting values in either direction */
+      std::chrono::nanoseconds conversionTime = std::chrono::nanoseconds(0);
+
+      size_t toLua(LuaType type) const { return valuesToLua[size_t(type)]; }
+      size_t fromLua(LuaType type) const { return valuesFromLua[size_t(type)]; }
+    };
+
+  }  // namespace lua
+}  // namespace glue
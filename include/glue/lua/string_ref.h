@@ -0,0 +1,67 @@
+#pragma once
+
+#include <memory>
+#include <ostream>
+#include <string>
+#include <string_view>
+
+struct lua_State;
+
+namespace glue {
+  namespace lua {
+
+    /**
+     * A reference to a lua string that can be read without copying. Lua strings are only passed
+     * to C++ as `StringRef` when requested explicitly, for example as a parameter of a typed
+     * function, and are copied into a `std::string` otherwise. The string is kept alive by a
+     * reference held by all copies. If its lua state is destroyed first, the contents are
+     * copied into the reference, so that it remains valid. Copies must be destroyed on the
+     * thread using the state, as releasing the reference modifies it.
+     */
+    class StringRef {
+    public:
+      /**
+       * Keeps the referenced string alive and provides its contents.
+       */
+      struct Pin {
+        virtual ~Pin() = default;
+        virtual std::string_view contents() const = 0;
+      };
+
+    private:
+      std::shared_ptr<const Pin> pin;
+
+    public:
+      StringRef() = default;
+      explicit StringRef(std::shared_ptr<const Pin> p) : pin(std::move(p)) {}
+
+      std::string_view view() const { return pin ? pin->contents() : std::string_view(); }
+      const char *data() const { return view().data(); }
+      size_t size() const { return view().size(); }
+      bool empty() const { return view().empty(); }
+
+      const std::shared_ptr<const Pin> &pinned() const { return pin; }
+
+      operator std::string_view() const { return view(); }
+      operator std::string() const { return std::string(view()); }
+
+      bool operator==(std::string_view other) const { return view() == other; }
+      bool operator!=(std::string_view other) const { return view() != other; }
+    };
+
+    inline std::ostream &operator<<(std::ostream &stream, const StringRef &string) {
+      return stream << string.view();
+    }
+
+    namespace stack {
+
+      /**
+       * Returns a reference to the lua string at the stack index without copying it.
+       * Throws a `std::runtime_error` if the value is not a string.
+       */
+      StringRef getStringRef(lua_State *state, int index);
+
+    }  // namespace stack
+
+  }  // namespace lua
+}  // namespace glue
@@ -0,0 +1,135 @@
+#include <glue/lua/allocator.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+
+using namespace glue;
+
+namespace {
+
+  constexpr bool isPooled(size_t size) { return size <= lua::PoolAllocator::maxPooledSize; }
+
+  constexpr size_t sizeClassOf(size_t size) {
+    return (size + lua::PoolAllocator::granularity - 1) / lua::PoolAllocator::granularity - 1;
+  }
+
+}  // namespace
+
+lua::PoolAllocator::PoolAllocator(size_t limit) { memory.limit = limit; }
+
+lua::PoolAllocator::~PoolAllocator() {
+  for (auto chunk : chunks) {
+    std::free(chunk);
+  }
+}
+
+void *lua::PoolAllocator::allocatePooled(size_t sizeClass) {
+  if (auto block = freeLists[sizeClass]) {
+    freeLists[sizeClass] = block->next;
+    return block;
+  }
+  auto size = (sizeClass + 1) * granularity;
+  if (size_t(chunkEnd - chunkPosition) < size) {
+    // the remainder of the current chunk is abandoned
+    auto chunk = static_cast<char *>(std::malloc(chunkSize));
+    if (!chunk) return nullptr;
+    chunks.push_back(chunk);
+    memory.reservedBytes += chunkSize;
+    chunkPosition = chunk;
+    chunkEnd = chunk + chunkSize;
+  }
+  auto block = chunkPosition;
+  chunkPosition += size;
+  return block;
+}
+
+void *lua::PoolAllocator::allocateBlock(size_t size) {
+  if (isPooled(size)) {
+    return allocatePooled(sizeClassOf(size));
+  }
+  auto block = std::malloc(size);
+  if (block) memory.reservedBytes += size;
+  return block;
+}
+
+void lua::PoolAllocator::freeBlock(void *block, size_t size) {
+  if (isPooled(size)) {
+    auto sizeClass = sizeClassOf(size);
+    freeLists[sizeClass] = new (block) FreeBlock{freeLists[sizeClass]};
+  } else {
+    std::free(block);
+    memory.reservedBytes -= size;
+  }
+}
+
+void lua::PoolAllocator::adopt(void *block) {
+  // the block stays reserved until the allocator is destroyed, like the pool's chunks
+  try {
+    chunks.push_back(block);
+  } catch (const std::bad_alloc &) {
+    // the block is leaked, as allocators called by lua must not throw
+  }
+}
+
+void *lua::PoolAllocator::reallocateBlock(void *block, size_t oldSize, size_t newSize) {
+  if (isPooled(oldSize) && isPooled(newSize) && sizeClassOf(oldSize) == sizeClassOf(newSize)) {
+    return block;
+  }
+  if (!isPooled(oldSize) && !isPooled(newSize)) {
+    auto result = std::realloc(block, newSize);
+    if (!result && newSize > oldSize) return nullptr;
+    // lua expects shrinking to never fail. A block kept at its old size is accounted with the
+    // new size, which is the size lua frees it with.
+    memory.reservedBytes += newSize;
+    memory.reservedBytes -= oldSize;
+    return result ? result : block;
+  }
+  auto result = allocateBlock(newSize);
+  if (!result) {
+    if (newSize > oldSize) return nullptr;
+    // lua expects shrinking to never fail. The block is kept and later freed with a pooled
+    // size, so blocks allocated with malloc are handed over to the pool.
+    if (!isPooled(oldSize)) adopt(block);
+    return block;
+  }
+  std::memcpy(result, block, std::min(oldSize, newSize));
+  freeBlock(block, oldSize);
+  return result;
+}
+
+void *lua::PoolAllocator::luaAllocate(void *allocator, void *block, size_t oldSize,
+                                      size_t newSize) {
+  auto &self = *static_cast<PoolAllocator *>(allocator);
+  auto &memory = self.memory;
+
+  if (newSize == 0) {
+    if (block) {
+      self.freeBlock(block, oldSize);
+      memory.liveBytes -= oldSize;
+      memory.deallocations++;
+    }
+    return nullptr;
+  }
+
+  // for new blocks, lua passes the type of the allocated object as `oldSize`
+  if (!block) oldSize = 0;
+
+  if (memory.limit > 0 && self.limitEnforced && newSize > oldSize
+      && memory.liveBytes - oldSize + newSize > memory.limit) {
+    memory.failedAllocations++;
+    return nullptr;
+  }
+
+  auto result = block ? self.reallocateBlock(block, oldSize, newSize) : self.allocateBlock(newSize);
+  if (!result) {
+    memory.failedAllocations++;
+    return nullptr;
+  }
+
+  if (!block) memory.allocations++;
+  memory.liveBytes = memory.liveBytes - oldSize + newSize;
+  memory.peakBytes = std::max(memory.peakBytes, memory.liveBytes);
+  return result;
+}
@@ -0,0 +1,27 @@
+#include <glue/lua/batch.h>
+
+#include <stdexcept>
+#include <string>
+
+using namespace glue;
+
+lua::Batch &lua::Batch::addColumn(const Buffer &column) {
+  if (column.size() != rows) {
+    throw std::invalid_argument("batch column has " + std::to_string(column.size())
+                                + " elements, expected " + std::to_string(rows));
+  }
+  argumentColumns.push_back(column);
+  return *this;
+}
+
+lua::Batch lua::Batch::slice(size_t offset, size_t count) const {
+  if (offset > rows || count > rows - offset) {
+    throw std::out_of_range("batch slice out of range");
+  }
+  Batch result(count);
+  result.argumentColumns.reserve(argumentColumns.size());
+  for (auto &column : argumentColumns) {
+    result.argumentColumns.push_back(column.slice(offset, count));
+  }
+  return result;
+}
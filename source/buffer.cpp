@@ -0,0 +1,254 @@
+#include <glue/lua/buffer.h>
+
+#include <cstdint>
+#include <lua.hpp>
+#include <new>
+#include <stdexcept>
+#include <string>
+
+using namespace glue;
+
+namespace {
+
+  constexpr auto metatableName = "LuaGlueBuffer";
+
+  lua::Buffer *checkBuffer(lua_State *state, int index) {
+    return static_cast<lua::Buffer *>(luaL_checkudata(state, index, metatableName));
+  }
+
+  void setElement(lua_State *state, const lua::Buffer &buffer, size_t index, int valueIndex) {
+    auto data = buffer.data();
+    switch (buffer.type()) {
+      case lua::Buffer::Type::Float32:
+        static_cast<float *>(data)[index] = float(luaL_checknumber(state, valueIndex));
+        break;
+      case lua::Buffer::Type::Float64:
+        static_cast<double *>(data)[index] = double(luaL_checknumber(state, valueIndex));
+        break;
+      case lua::Buffer::Type::Int32: {
+        auto value = luaL_checkinteger(state, valueIndex);
+        luaL_argcheck(state, value >= INT32_MIN && value <= INT32_MAX, valueIndex,
+                      "value out of range for int32");
+        static_cast<int32_t *>(data)[index] = int32_t(value);
+        break;
+      }
+      case lua::Buffer::Type::Int64:
+        static_cast<int64_t *>(data)[index] = int64_t(luaL_checkinteger(state, valueIndex));
+        break;
+      case lua::Buffer::Type::UInt8: {
+        auto value = luaL_checkinteger(state, valueIndex);
+        luaL_argcheck(state, value >= 0 && value <= UINT8_MAX, valueIndex,
+                      "value out of range for uint8");
+        static_cast<uint8_t *>(data)[index] = uint8_t(value);
+        break;
+      }
+    }
+  }
+
+  // note: lua errors unwind using longjmp, so no C++ objects with destructors may be alive when
+  // calling `luaL_error` or one of the `luaL_check` functions
+
+  int bufferIndex(lua_State *state) {
+    auto buffer = checkBuffer(state, 1);
+    if (lua_type(state, 2) == LUA_TNUMBER) {
+      int isInteger = 0;
+      auto index = lua_tointegerx(state, 2, &isInteger);
+      if (isInteger && index >= 1 && lua_Unsigned(index) <= buffer->size()) {
+        lua::stack::pushBufferElement(state, *buffer, size_t(index - 1));
+      } else {
+        lua_pushnil(state);
+      }
+      return 1;
+    }
+    // methods are kept in a separate table, so that metamethods are not reachable from lua
+    lua_pushvalue(state, 2);
+    lua_rawget(state, lua_upvalueindex(1));
+    return 1;
+  }
+
+  int bufferNewIndex(lua_State *state) {
+    auto buffer = checkBuffer(state, 1);
+    auto index = luaL_checkinteger(state, 2);
+    if (buffer->isReadOnly()) {
+      return luaL_error(state, "attempt to modify a read-only buffer");
+    }
+    if (index < 1 || lua_Unsigned(index) > buffer->size()) {
+      return luaL_error(state, "buffer index %I out of range", lua_Integer(index));
+    }
+    setElement(state, *buffer, size_t(index - 1), 3);
+    return 0;
+  }
+
+  int bufferLength(lua_State *state) {
+    lua_pushinteger(state, lua_Integer(checkBuffer(state, 1)->size()));
+    return 1;
+  }
+
+  int bufferSlice(lua_State *state) {
+    auto buffer = checkBuffer(state, 1);
+    auto size = lua_Integer(buffer->size());
+    auto first = luaL_checkinteger(state, 2);
+    auto last = luaL_optinteger(state, 3, size);
+    if (first < 1 || last > size || first > last + 1) {
+      return luaL_error(state, "buffer slice out of range");
+    }
+    // the slice is constructed in place, as allocating the userdata may raise a memory error
+    auto slice = lua_newuserdatauv(state, sizeof(lua::Buffer), 0);
+    new (slice) lua::Buffer(buffer->slice(size_t(first - 1), size_t(last - first + 1)));
+    luaL_setmetatable(state, metatableName);
+    return 1;
+  }
+
+  int bufferToString(lua_State *state) {
+    auto buffer = checkBuffer(state, 1);
+    lua_pushfstring(state, "Buffer<%s>(%I)", lua::Buffer::typeName(buffer->type()),
+                    lua_Integer(buffer->size()));
+    return 1;
+  }
+
+  int bufferDestroy(lua_State *state) {
+    checkBuffer(state, 1)->~Buffer();
+    return 0;
+  }
+
+}  // namespace
+
+size_t lua::Buffer::elementSize(Type type) {
+  switch (type) {
+    case Type::Float32:
+      return sizeof(float);
+    case Type::Float64:
+      return sizeof(double);
+    case Type::Int32:
+      return sizeof(int32_t);
+    case Type::Int64:
+      return sizeof(int64_t);
+    case Type::UInt8:
+      return sizeof(uint8_t);
+  }
+  return 0;
+}
+
+const char *lua::Buffer::typeName(Type type) {
+  switch (type) {
+    case Type::Float32:
+      return "float32";
+    case Type::Float64:
+      return "float64";
+    case Type::Int32:
+      return "int32";
+    case Type::Int64:
+      return "int64";
+    case Type::UInt8:
+      return "uint8";
+  }
+  return "unknown";
+}
+
+lua::Buffer lua::Buffer::slice(size_t offset, size_t count) const {
+  if (offset > length || count > length - offset) {
+    throw std::out_of_range("buffer slice out of range");
+  }
+  Buffer result(*this);
+  result.elements = static_cast<char *>(elements) + offset * elementSize(elementType);
+  result.length = count;
+  return result;
+}
+
+void lua::Buffer::checkAccess(Type type, bool write) const {
+  if (type != elementType) {
+    throw std::runtime_error(std::string("buffer contains ") + typeName(elementType)
+                             + " elements, not " + typeName(type));
+  }
+  if (write && readOnly) {
+    throw std::runtime_error("buffer is read-only");
+  }
+}
+
+void lua::stack::registerBufferMetatable(lua_State *state) {
+  if (luaL_newmetatable(state, metatableName)) {
+    const luaL_Reg metamethods[] = {
+        {"__newindex", bufferNewIndex}, {"__len", bufferLength}, {"__tostring", bufferToString},
+        {"__gc", bufferDestroy},        {nullptr, nullptr},
+    };
+    luaL_setfuncs(state, metamethods, 0);
+    const luaL_Reg methods[] = {
+        {"slice", bufferSlice},
+        {"size", bufferLength},
+        {nullptr, nullptr},
+    };
+    luaL_newlib(state, methods);
+    lua_pushcclosure(state, bufferIndex, 1);
+    lua_setfield(state, -2, "__index");
+    // hides the metatable and its finalizer from `getmetatable`
+    lua_pushliteral(state, "LuaGlueBuffer");
+    lua_setfield(state, -2, "__metatable");
+  }
+  lua_pop(state, 1);
+}
+
+void lua::stack::pushBuffer(lua_State *state, const Buffer &buffer) {
+  registerBufferMetatable(state);
+  new (lua_newuserdatauv(state, sizeof(Buffer), 0)) Buffer(buffer);
+  luaL_setmetatable(state, metatableName);
+}
+
+lua::Buffer *lua::stack::toBuffer(lua_State *state, int index) {
+  return static_cast<Buffer *>(luaL_testudata(state, index, metatableName));
+}
+
+void lua::stack::pushBufferElement(lua_State *state, const Buffer &buffer, size_t index) {
+  auto data = buffer.data();
+  switch (buffer.type()) {
+    case Buffer::Type::Float32:
+      lua_pushnumber(state, static_cast<const float *>(data)[index]);
+      break;
+    case Buffer::Type::Float64:
+      lua_pushnumber(state, static_cast<const double *>(data)[index]);
+      break;
+    case Buffer::Type::Int32:
+      lua_pushinteger(state, static_cast<const int32_t *>(data)[index]);
+      break;
+    case Buffer::Type::Int64:
+      lua_pushinteger(state, static_cast<const int64_t *>(data)[index]);
+      break;
+    case Buffer::Type::UInt8:
+      lua_pushinteger(state, static_cast<const uint8_t *>(data)[index]);
+      break;
+  }
+}
+
+bool lua::stack::toBufferElement(lua_State *state, int valueIndex, const Buffer &buffer,
+                                 size_t index) {
+  // numeric strings are rejected, as lua only converts them implicitly in arithmetic
+  if (lua_type(state, valueIndex) != LUA_TNUMBER) return false;
+  auto data = buffer.data();
+  int isInteger = 0;
+  switch (buffer.type()) {
+    case Buffer::Type::Float32:
+      static_cast<float *>(data)[index] = float(lua_tonumber(state, valueIndex));
+      return true;
+    case Buffer::Type::Float64:
+      static_cast<double *>(data)[index] = double(lua_tonumber(state, valueIndex));
+      return true;
+    case Buffer::Type::Int32: {
+      auto value = lua_tointegerx(state, valueIndex, &isInteger);
+      if (!isInteger || value < INT32_MIN || value > INT32_MAX) return false;
+      static_cast<int32_t *>(data)[index] = int32_t(value);
+      return true;
+    }
+    case Buffer::Type::Int64: {
+      auto value = lua_tointegerx(state, valueIndex, &isInteger);
+      if (!isInteger) return false;
+      static_cast<int64_t *>(data)[index] = int64_t(value);
+      return true;
+    }
+    case Buffer::Type::UInt8: {
+      auto value = lua_tointegerx(state, valueIndex, &isInteger);
+      if (!isInteger || value < 0 || value > UINT8_MAX) return false;
+      static_cast<uint8_t *>(data)[index] = uint8_t(value);
+      return true;
+    }
+  }
+  return false;
+}
@@ -0,0 +1,131 @@
+#include <glue/lua/pool.h>
+
+#include <deque>
+#include <stdexcept>
+
+using namespace glue;
+
+namespace {
+
+  // identifies the pool and worker of the current thread, so that jobs submitted from within a
+  // job are queued on the submitting worker
+  thread_local const lua::StatePool *currentPool = nullptr;
+  thread_local size_t currentWorker = 0;
+
+}  // namespace
+
+struct lua::StatePool::Worker {
+  std::mutex mutex;
+  std::deque<Job> jobs;
+  std::unique_ptr<State> state;
+  std::thread thread;
+};
+
+lua::StatePool::StatePool(const Initializer &initialize, size_t size) {
+  workers.reserve(std::max<size_t>(size, 1));
+  for (size_t i = 0; i < std::max<size_t>(size, 1); ++i) {
+    auto worker = std::make_unique<Worker>();
+    worker->state = std::make_unique<State>();
+    if (initialize) initialize(*worker->state);
+    workers.push_back(std::move(worker));
+  }
+  for (size_t i = 0; i < workers.size(); ++i) {
+    workers[i]->thread = std::thread([this, i]() { run(i); });
+  }
+}
+
+lua::StatePool::~StatePool() {
+  {
+    std::lock_guard<std::mutex> lock(sleepMutex);
+    stopping = true;
+  }
+  wakeUp.notify_all();
+  for (auto &worker : workers) {
+    worker->thread.join();
+  }
+}
+
+void lua::StatePool::post(Job job) {
+  auto index = currentPool == this ? currentWorker : nextWorker++ % workers.size();
+  {
+    auto &worker = *workers[index];
+    std::lock_guard<std::mutex> lock(worker.mutex);
+    worker.jobs.push_back(std::move(job));
+  }
+  pending++;
+  // sleeping workers check `pending` while holding the lock, so that the notification
+  // cannot be lost
+  if (sleeping > 0) {
+    std::lock_guard<std::mutex> lock(sleepMutex);
+    wakeUp.notify_one();
+  }
+}
+
+bool lua::StatePool::takeJob(size_t index, Job &job) {
+  {
+    auto &worker = *workers[index];
+    std::lock_guard<std::mutex> lock(worker.mutex);
+    if (!worker.jobs.empty()) {
+      job = std::move(worker.jobs.front());
+      worker.jobs.pop_front();
+      return true;
+    }
+  }
+  // steal from the back of the other queues
+  for (size_t offset = 1; offset < workers.size(); ++offset) {
+    auto &victim = *workers[(index + offset) % workers.size()];
+    std::lock_guard<std::mutex> lock(victim.mutex);
+    if (!victim.jobs.empty()) {
+      job = std::move(victim.jobs.back());
+      victim.jobs.pop_back();
+      return true;
+    }
+  }
+  return false;
+}
+
+void lua::StatePool::run(size_t index) {
+  currentPool = this;
+  currentWorker = index;
+  auto &state = *workers[index]->state;
+  while (true) {
+    Job job;
+    if (takeJob(index, job)) {
+      pending--;
+      job(state);
+      continue;
+    }
+    std::unique_lock<std::mutex> lock(sleepMutex);
+    sleeping++;
+    wakeUp.wait(lock, [this]() { return stopping || pending > 0; });
+    sleeping--;
+    if (stopping && pending == 0) {
+      return;
+    }
+  }
+}
+
+void lua::StatePool::callBatch(const std::string &function, const Batch &batch,
+                               const Buffer &results) {
+  if (results.size() != batch.size()) {
+    throw std::invalid_argument("batch results need one element per row");
+  }
+  auto slices = std::min(workers.size(), std::max<size_t>(batch.size(), 1));
+  std::vector<std::future<void>> futures;
+  futures.reserve(slices);
+  for (size_t i = 0, offset = 0; i < slices; ++i) {
+    auto count = batch.size() / slices + (i < batch.size() % slices ? 1 : 0);
+    futures.push_back(submit([&function, slice = batch.slice(offset, count),
+                              target = results.slice(offset, count)](State &state) {
+      state.callBatch(state.get(function), slice, target);
+    }));
+    offset += count;
+  }
+  // wait for all slices before rethrowing, as they reference the arguments
+  for (auto &future : futures) {
+    future.wait();
+  }
+  for (auto &future : futures) {
+    future.get();
+  }
+}
@@ -0,0 +1,52 @@
+#include <glue/lua/profiler.h>
+
+#include <algorithm>
+#include <set>
+#include <sstream>
+#include <unordered_map>
+
+using namespace glue;
+
+std::string lua::Profile::foldedStacks() const {
+  std::stringstream stream;
+  for (auto &&[stack, time] : stacks) {
+    auto microseconds = std::chrono::duration_cast<std::chrono::microseconds>(time).count();
+    if (microseconds > 0) {
+      stream << stack << ' ' << microseconds << '\n';
+    }
+  }
+  return stream.str();
+}
+
+std::vector<lua::FunctionProfile> lua::Profile::functions() const {
+  std::unordered_map<std::string, FunctionProfile> profiles;
+  std::set<std::string> seen;
+  for (auto &&[stack, time] : stacks) {
+    seen.clear();
+    size_t begin = 0;
+    while (begin <= stack.size()) {
+      auto end = std::min(stack.find(';', begin), stack.size());
+      auto name = stack.substr(begin, end - begin);
+      auto &profile = profiles[name];
+      // recursive functions are only counted once per stack
+      if (seen.insert(name).second) {
+        profile.totalTime += time;
+      }
+      if (end == stack.size()) {
+        profile.selfTime += time;
+      }
+      begin = end + 1;
+    }
+  }
+
+  std::vector<FunctionProfile> result;
+  result.reserve(profiles.size());
+  for (auto &&[name, profile] : profiles) {
+    result.push_back(profile);
+    result.back().name = name;
+  }
+  std::sort(result.begin(), result.end(), [](const auto &a, const auto &b) {
+    return a.selfTime != b.selfTime ? a.selfTime > b.selfTime : a.name < b.name;
+  });
+  return result;
+}
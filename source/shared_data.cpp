@@ -0,0 +1,206 @@
+#include <glue/lua/shared_data.h>
+
+#include <lua.hpp>
+#include <new>
+
+using namespace glue;
+
+namespace {
+
+  constexpr auto metatableName = "LuaGlueSharedData";
+
+  lua::SharedData *checkSharedData(lua_State *state, int index) {
+    return static_cast<lua::SharedData *>(luaL_checkudata(state, index, metatableName));
+  }
+
+  void pushValue(lua_State *state, const lua::SharedData &data);
+
+  // note: lua errors unwind using longjmp, so no C++ objects with destructors may be alive when
+  // calling `luaL_error` or one of the `luaL_check` functions
+
+  int sharedDataIndex(lua_State *state) {
+    auto &data = *checkSharedData(state, 1);
+    if (data.type() == lua::SharedData::Type::Array) {
+      int isInteger = 0;
+      auto index = lua_tointegerx(state, 2, &isInteger);
+      auto &array = data.asArray();
+      if (isInteger && index >= 1 && lua_Unsigned(index) <= array.size()) {
+        pushValue(state, array[size_t(index - 1)]);
+      } else {
+        lua_pushnil(state);
+      }
+      return 1;
+    }
+    size_t length = 0;
+    auto key = lua_type(state, 2) == LUA_TSTRING ? lua_tolstring(state, 2, &length) : nullptr;
+    if (key) {
+      auto &table = data.asTable();
+      auto it = table.find(std::string_view(key, length));
+      if (it != table.end()) {
+        pushValue(state, it->second);
+        return 1;
+      }
+    }
+    lua_pushnil(state);
+    return 1;
+  }
+
+  int sharedDataNewIndex(lua_State *state) {
+    checkSharedData(state, 1);
+    return luaL_error(state, "attempt to modify shared data");
+  }
+
+  /**
+   * Returns the border of the proxied value, which is always 0 for tables as their keys are
+   * strings.
+   */
+  int sharedDataLength(lua_State *state) {
+    auto &data = *checkSharedData(state, 1);
+    auto isArray = data.type() == lua::SharedData::Type::Array;
+    lua_pushinteger(state, isArray ? lua_Integer(data.size()) : 0);
+    return 1;
+  }
+
+  /**
+   * Returns the entry following the key in argument 2, as `next` does for tables.
+   */
+  int sharedDataNext(lua_State *state) {
+    auto &data = *checkSharedData(state, 1);
+    if (data.type() == lua::SharedData::Type::Array) {
+      auto index = lua_isnil(state, 2) ? 0 : luaL_checkinteger(state, 2);
+      auto &array = data.asArray();
+      if (index < 0 || lua_Unsigned(index) >= array.size()) {
+        lua_pushnil(state);
+        return 1;
+      }
+      lua_pushinteger(state, index + 1);
+      pushValue(state, array[size_t(index)]);
+      return 2;
+    }
+    auto &table = data.asTable();
+    auto it = table.begin();
+    if (!lua_isnil(state, 2)) {
+      size_t length = 0;
+      auto key = luaL_checklstring(state, 2, &length);
+      it = table.upper_bound(std::string_view(key, length));
+    }
+    if (it == table.end()) {
+      lua_pushnil(state);
+      return 1;
+    }
+    lua_pushlstring(state, it->first.data(), it->first.size());
+    pushValue(state, it->second);
+    return 2;
+  }
+
+  int sharedDataPairs(lua_State *state) {
+    checkSharedData(state, 1);
+    lua_pushcfunction(state, sharedDataNext);
+    lua_pushvalue(state, 1);
+    lua_pushnil(state);
+    return 3;
+  }
+
+  int sharedDataEquals(lua_State *state) {
+    auto a = static_cast<lua::SharedData *>(luaL_testudata(state, 1, metatableName));
+    auto b = static_cast<lua::SharedData *>(luaL_testudata(state, 2, metatableName));
+    lua_pushboolean(state, a && b && a->isSame(*b));
+    return 1;
+  }
+
+  int sharedDataToString(lua_State *state) {
+    auto &data = *checkSharedData(state, 1);
+    auto kind = data.type() == lua::SharedData::Type::Array ? "array" : "table";
+    lua_pushfstring(state, "SharedData<%s>(%d)", kind, int(data.size()));
+    return 1;
+  }
+
+  int sharedDataDestroy(lua_State *state) {
+    checkSharedData(state, 1)->~SharedData();
+    return 0;
+  }
+
+  void registerSharedDataMetatable(lua_State *state) {
+    if (luaL_newmetatable(state, metatableName)) {
+      const luaL_Reg functions[] = {
+          {"__index", sharedDataIndex},       {"__newindex", sharedDataNewIndex},
+          {"__len", sharedDataLength},        {"__pairs", sharedDataPairs},
+          {"__eq", sharedDataEquals},         {"__tostring", sharedDataToString},
+          {"__gc", sharedDataDestroy},        {nullptr, nullptr},
+      };
+      luaL_setfuncs(state, functions, 0);
+      lua_pushstring(state, metatableName);
+      lua_setfield(state, -2, "__metatable");
+    }
+    lua_pop(state, 1);
+  }
+
+  /**
+   * Pushes the value assuming the metatable is registered, as it is for all values reached
+   * through an existing proxy.
+   */
+  void pushValue(lua_State *state, const lua::SharedData &data) {
+    switch (data.type()) {
+      case lua::SharedData::Type::Nil:
+        lua_pushnil(state);
+        break;
+      case lua::SharedData::Type::Boolean:
+        lua_pushboolean(state, data.asBoolean());
+        break;
+      case lua::SharedData::Type::Integer:
+        lua_pushinteger(state, data.asInteger());
+        break;
+      case lua::SharedData::Type::Number:
+        lua_pushnumber(state, data.asNumber());
+        break;
+      case lua::SharedData::Type::String:
+        lua_pushlstring(state, data.asString().data(), data.asString().size());
+        break;
+      case lua::SharedData::Type::Array:
+      case lua::SharedData::Type::Table:
+        new (lua_newuserdatauv(state, sizeof(lua::SharedData), 0)) lua::SharedData(data);
+        luaL_setmetatable(state, metatableName);
+        break;
+    }
+  }
+
+}  // namespace
+
+double lua::SharedData::asNumber() const {
+  if (type() == Type::Integer) {
+    return double(asInteger());
+  }
+  return std::get<double>(*node);
+}
+
+size_t lua::SharedData::size() const {
+  switch (type()) {
+    case Type::Array:
+      return asArray().size();
+    case Type::Table:
+      return asTable().size();
+    default:
+      return 0;
+  }
+}
+
+lua::SharedData lua::SharedData::operator[](std::string_view key) const {
+  if (type() != Type::Table) {
+    return SharedData();
+  }
+  auto &table = asTable();
+  auto it = table.find(key);
+  return it != table.end() ? it->second : SharedData();
+}
+
+void lua::stack::pushSharedData(lua_State *state, const SharedData &data) {
+  auto type = data.type();
+  if (type == SharedData::Type::Array || type == SharedData::Type::Table) {
+    registerSharedDataMetatable(state);
+  }
+  pushValue(state, data);
+}
+
+lua::SharedData *lua::stack::toSharedData(lua_State *state, int index) {
+  return static_cast<SharedData *>(luaL_testudata(state, index, metatableName));
+}
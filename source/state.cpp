@@ -2,12 +2,26 @@
 #include <easy_iterator.h>
 #include <glue/keys.h>
 #include <glue/lua/state.h>
-#include <observe/event.h>
+#include <limits.h>
 #include <stdint.h>
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstring>
 #include <exception>
+#include <filesystem>
+#include <fstream>
+#include <list>
 #include <memory>
+#include <new>
+#include <optional>
 #include <sstream>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
 
 #define SOL_PRINT_ERRORS 0
 #define SOL_SAFE_NUMERICS 1
@@ -22,51 +36,793 @@ namespace glue {
 
       using MapCache = std::unordered_map<const glue::Map *, sol::table>;
 
-      sol::object anyToSol(lua_State *state, const Any &value, MapCache *cache = nullptr);
+      /**
+       * Converts values to lua. If `lazy` is set, maps other than classes are pushed as proxy
+       * tables which convert their entries on first access.
+       */
+      void pushAny(lua_State *state, const Any &value, MapCache *cache = nullptr,
+                   bool lazy = false);
+      sol::object anyToSol(lua_State *state, const Any &value, MapCache *cache = nullptr,
+                           bool lazy = false);
+      Any stackToAny(lua_State *state, int index);
       Any solToAny(sol::object value);
+      void callProtected(lua_State *state, int nargs, int nresults);
+
+      struct LuaGlueData;
+      LuaGlueData &getLuaGlueData(lua_State *state);
+
+      namespace lazy {
+        void materialize(lua_State *state, int table);
+      }
+
+      /**
+       * Links a lua reference into an intrusive list of references that are released before the
+       * lua state is destroyed. Attaching and detaching is constant time and does not allocate.
+       */
+      class ReferenceHandle {
+      private:
+        sol::main_reference *reference;
+        LuaGlueData *owner = nullptr;
+        ReferenceHandle *previous = nullptr;
+        ReferenceHandle *next = nullptr;
+
+        friend struct LuaGlueData;
+
+      public:
+        explicit ReferenceHandle(sol::main_reference &r) : reference(&r) {}
+        ReferenceHandle(const ReferenceHandle &) = delete;
+        ReferenceHandle &operator=(const ReferenceHandle &) = delete;
+        virtual ~ReferenceHandle() { detach(); }
+
+        LuaGlueData *getOwner() const { return owner; }
+        void attach(LuaGlueData *data);
+        void attach(lua_State *state) {
+          if (state) attach(&getLuaGlueData(state));
+        }
+        void detach();
+
+        /**
+         * Empties the reference before the state is destroyed.
+         */
+        virtual void release() { *reference = sol::main_reference(); }
+      };
+
+      /**
+       * The budget of the running call into lua.
+       */
+      struct ActiveBudget {
+        Budget budget;
+        // the thread entered from C++, which is the only thread suspended by the budget
+        lua_State *thread = nullptr;
+        size_t executed = 0;
+        std::chrono::steady_clock::time_point deadline;
+        bool exhausted = false;
+      };
+
+      /**
+       * A hook installed on a lua thread.
+       */
+      struct HookState {
+        lua_Hook hook = nullptr;
+        int mask = 0;
+        int count = 0;
+
+        static HookState get(lua_State *thread) {
+          return HookState{lua_gethook(thread), lua_gethookmask(thread), lua_gethookcount(thread)};
+        }
+
+        void set(lua_State *thread) const { lua_sethook(thread, hook, mask, count); }
+      };
+
+      /**
+       * Samples call stacks from the count hook and measures calls of native functions. Native
+       * calls only record their duration per function, which is attributed to the stack of the
+       * next sample, so that profiling does not walk the stack on every call.
+       */
+      struct Profiler {
+        using Clock = std::chrono::steady_clock;
+
+        struct NativeTime {
+          const void *function;
+          std::chrono::nanoseconds time;
+        };
+
+        ProfilerOptions options;
+        Profile profile;
+        bool running = false;
+        size_t executed = 0;
+        // time attributed to samples, used to exclude time already attributed to nested calls
+        std::chrono::nanoseconds attributed = std::chrono::nanoseconds(0);
+        std::chrono::nanoseconds attributedAtMark = std::chrono::nanoseconds(0);
+        Clock::time_point lastMark;
+        std::vector<std::string> frames;
+        std::vector<NativeTime> pendingNative;
+        // names are resolved on the first call of each native function
+        std::unordered_map<const void *, std::string> nativeNames;
+        // the hook of the main thread replaced by the profiler
+        HookState foreignHook;
+
+        /**
+         * Starts measuring time from now. Called when entering lua from C++, so that time spent
+         * outside of lua is not attributed to lua code.
+         */
+        void mark() {
+          lastMark = Clock::now();
+          attributedAtMark = attributed;
+        }
+
+        static std::string frameName(lua_State *state, lua_Debug &ar) {
+          lua_getinfo(state, "Snf", &ar);
+          std::string name = ar.name ? ar.name : "?";
+          if (*ar.what == 'C') {
+            // functions bound from C++ keep their data in the first upvalue
+            bool isNative = false;
+            if (lua_getupvalue(state, -1, 1)) {
+              isNative = luaL_testudata(state, -1, "LuaGlueFunction") != nullptr;
+              lua_pop(state, 1);
+            }
+            lua_pop(state, 1);
+            return (isNative ? "[native] " : "[C] ") + name;
+          }
+          lua_pop(state, 1);
+          if (*ar.what == 'm') {
+            return std::string("main (") + ar.short_src + ")";
+          }
+          return name + " (" + ar.short_src + ":" + std::to_string(ar.linedefined) + ")";
+        }
+
+        /**
+         * Attributes the native calls since the last sample to the stack.
+         */
+        void flushNative(const std::string &stack) {
+          for (auto &pending : pendingNative) {
+            auto &name = nativeNames[pending.function];
+            profile.stacks[stack.empty() ? name : stack + ';' + name] += pending.time;
+          }
+          pendingNative.clear();
+        }
+
+        void record(lua_State *state, std::chrono::nanoseconds time) {
+          attributed += time;
+          // called from hooks, so allocation failures only lose the sample
+          try {
+            frames.clear();
+            lua_Debug ar;
+            for (int level = 0;
+                 size_t(level) < options.maxDepth && lua_getstack(state, level, &ar); ++level) {
+              frames.push_back(frameName(state, ar));
+            }
+            std::string stack;
+            for (auto it = frames.rbegin(); it != frames.rend(); ++it) {
+              if (!stack.empty()) stack += ';';
+              stack += *it;
+            }
+            profile.stacks[stack] += time;
+            profile.samples++;
+            flushNative(stack);
+          } catch (...) {
+          }
+        }
+
+        void tick(lua_State *state, int instructions) {
+          executed += size_t(instructions);
+          if (executed < options.interval) return;
+          executed = 0;
+          auto now = Clock::now();
+          auto time = (now - lastMark) - (attributed - attributedAtMark);
+          record(state, std::max(time, Clock::duration(0)));
+          lastMark = now;
+          attributedAtMark = attributed;
+        }
+
+        /**
+         * Adds the time spent in the native function at stack level 0, excluding time attributed
+         * to lua code called by it.
+         */
+        void recordNative(lua_State *state, const void *function, Clock::time_point start,
+                          std::chrono::nanoseconds attributedAtStart) {
+          auto time = (Clock::now() - start) - (attributed - attributedAtStart);
+          time = std::max(time, Clock::duration(0));
+          attributed += time;
+          for (auto &pending : pendingNative) {
+            if (pending.function == function) {
+              pending.time += time;
+              return;
+            }
+          }
+          try {
+            if (nativeNames.find(function) == nativeNames.end()) {
+              lua_Debug ar;
+              const char *name = nullptr;
+              if (lua_getstack(state, 0, &ar) && lua_getinfo(state, "n", &ar)) name = ar.name;
+              nativeNames.emplace(function, std::string("[native] ") + (name ? name : "?"));
+            }
+            pendingNative.push_back(NativeTime{function, time});
+          } catch (...) {
+          }
+        }
+      };
+
+      /**
+       * Buffers holding the last error of a non-throwing call, which are reused between errors.
+       */
+      struct ErrorStorage {
+        std::string message;
+        std::string traceback;
+        char chunk[LUA_IDSIZE] = {0};
+        int line = -1;
+        bool tracebacks = false;
+      };
 
       struct LuaGlueData {
         LuaGlueData() = default;
         LuaGlueData(const LuaGlueData &) = delete;
+        ~LuaGlueData();
+
         Context context;
-        observe::Event<> onDestroy;
+        ReferenceHandle *handles = nullptr;
+        bool cacheMaps = false;
+        Budget budget;
+        ActiveBudget *activeBudget = nullptr;
+        // the hook installed by the application, called from the hook dispatcher
+        HookState foreignHook;
+        std::unique_ptr<Profiler> profiler;
+        BoundaryStats stats;
+        unsigned conversionDepth = 0;
+        // owned here so that metatables can reference them as light userdata
+        std::vector<std::unique_ptr<InlineType>> inlineTypes;
+        GCStats gcStats;
+        /** the collector mode last selected, either `LUA_GCINC` or `LUA_GCGEN` */
+        int gcMode = LUA_GCINC;
+        ErrorStorage lastError;
+        // lazily added modules whose classes are registered once an unknown instance is converted
+        std::vector<glue::MapValue> pendingModules;
+
+        /**
+         * Releases all references held by C++ objects, leaving them empty.
+         */
+        void releaseHandles() {
+          while (auto handle = handles) {
+            handle->detach();
+            handle->release();
+          }
+        }
       };
 
-      struct LuaGlueInstance : public Any {
-        sol::main_table classTable;
+      void ReferenceHandle::attach(LuaGlueData *data) {
+        detach();
+        owner = data;
+        next = owner->handles;
+        if (next) next->previous = this;
+        owner->handles = this;
+      }
+
+      void ReferenceHandle::detach() {
+        if (!owner) return;
+        if (previous) {
+          previous->next = next;
+        } else {
+          owner->handles = next;
+        }
+        if (next) next->previous = previous;
+        owner = nullptr;
+        previous = next = nullptr;
+      }
+
+      /**
+       * Instances of registered classes are stored as userdata containing an `Any`. All instances
+       * of a class share a metatable whose `__index` is the class table, so that method lookups
+       * are plain lua table accesses.
+       */
+      namespace instances {
+
+        // the addresses are used as unique registry and metatable keys
+        const char marker = 0;
+        const char metatablesKey = 0;
+        const char nameKey = 0;
+
+        Any *get(lua_State *state, int index) {
+          if (lua_type(state, index) != LUA_TUSERDATA || !lua_getmetatable(state, index)) {
+            return nullptr;
+          }
+          lua_rawgetp(state, -1, &marker);
+          bool isInstance = lua_toboolean(state, -1);
+          lua_pop(state, 2);
+          return isInstance ? static_cast<Any *>(lua_touserdata(state, index)) : nullptr;
+        }
+
+        Any *get(const sol::object &value) {
+          auto state = value.lua_state();
+          value.push(state);
+          auto result = get(state, -1);
+          lua_pop(state, 1);
+          return result;
+        }
+
+        int destroy(lua_State *state) {
+          if (auto value = get(state, 1)) {
+            value->~Any();
+            // leave a valid object in case the finalizer is called again
+            new (value) Any();
+          }
+          return 0;
+        }
+
+        int toString(lua_State *state) {
+          auto value = get(state, 1);
+          if (!value) {
+            return luaL_argerror(state, 1, "instance expected");
+          }
+          // only lua values are used, as pushing the result may raise an error
+          lua_getmetatable(state, 1);
+          lua_rawgetp(state, -1, &nameKey);
+          lua_pushfstring(state, "%s(%p)", lua_tostring(state, -1), static_cast<void *>(value));
+          return 1;
+        }
+
+        /**
+         * Pushes the metatable shared by all instances of the class, whose type is called `name`.
+         */
+        void pushMetatable(lua_State *state, const sol::main_table &classTable,
+                           std::string_view name) {
+          // metatables are cached in a registry table with weak keys, indexed by the class table
+          if (lua_rawgetp(state, LUA_REGISTRYINDEX, &metatablesKey) != LUA_TTABLE) {
+            lua_pop(state, 1);
+            lua_newtable(state);
+            lua_createtable(state, 0, 1);
+            lua_pushliteral(state, "k");
+            lua_setfield(state, -2, "__mode");
+            lua_setmetatable(state, -2);
+            lua_pushvalue(state, -1);
+            lua_rawsetp(state, LUA_REGISTRYINDEX, &metatablesKey);
+          }
+
+          classTable.push(state);
+          if (lua_rawget(state, -2) == LUA_TTABLE) {
+            lua_remove(state, -2);
+            return;
+          }
+          lua_pop(state, 1);
+
+          sol::table metatable(state, sol::create);
+          metatable[sol::meta_function::index] = classTable;
+
+          // operators are resolved once, including those inherited from extended classes
+          auto forward = [&](sol::meta_function luaName, auto glueName) {
+            sol::object method = classTable[glueName];
+            if (method.valid()) {
+              metatable[luaName] = method;
+            }
+          };
+
+          forward(sol::meta_function::equal_to, keys::operators::eq);
+          forward(sol::meta_function::unary_minus, keys::operators::unm);
+          forward(sol::meta_function::addition, keys::operators::add);
+          forward(sol::meta_function::subtraction, keys::operators::sub);
+          forward(sol::meta_function::multiplication, keys::operators::mul);
+          forward(sol::meta_function::division, keys::operators::div);
+          forward(sol::meta_function::power_of, keys::operators::pow);
+          forward(sol::meta_function::less_than, keys::operators::lt);
+          forward(sol::meta_function::less_than_or_equal_to, keys::operators::le);
+          forward(sol::meta_function::floor_division, keys::operators::idiv);
+          forward(sol::meta_function::modulus, keys::operators::mod);
+          forward(sol::meta_function::to_string, keys::operators::tostring);
+
+          metatable.push(state);
+          if (lua_getfield(state, -1, "__tostring") == LUA_TNIL) {
+            lua_pushcfunction(state, toString);
+            lua_setfield(state, -3, "__tostring");
+          }
+          lua_pop(state, 1);
+          lua_pushcfunction(state, destroy);
+          lua_setfield(state, -2, "__gc");
+          lua_pushboolean(state, 1);
+          lua_rawsetp(state, -2, &marker);
+          lua_pushlstring(state, name.data(), name.size());
+          lua_rawsetp(state, -2, &nameKey);
+
+          // cache[classTable] = metatable
+          classTable.push(state);
+          lua_pushvalue(state, -2);
+          lua_rawset(state, -4);
+          lua_remove(state, -2);
+        }
+
+        void push(lua_State *state, Any &&value, const sol::main_table &classTable) {
+          pushMetatable(state, classTable, value.type().name);
+          new (lua_newuserdatauv(state, sizeof(Any), 0)) Any(std::move(value));
+          lua_pushvalue(state, -2);
+          lua_setmetatable(state, -2);
+          lua_remove(state, -2);
+        }
+
+      }  // namespace instances
+
+      // the address is used as a unique registry key
+      const char luaGlueDataKey = 0;
+
+      int destroyLuaGlueData(lua_State *state) {
+        static_cast<LuaGlueData *>(lua_touserdata(state, 1))->~LuaGlueData();
+        return 0;
+      }
+
+      static_assert(LUA_EXTRASPACE >= sizeof(LuaGlueData *), "lua has no room for the data");
+
+      LuaGlueData &getLuaGlueData(lua_State *state) {
+        return **static_cast<LuaGlueData **>(lua_getextraspace(state));
+      }
+
+      /**
+       * Creates the data of the state unless it already exists and stores its address in the
+       * extra space of the main thread, which lua copies to all threads created afterwards.
+       */
+      void initLuaGlueData(lua_State *state) {
+        LuaGlueData *data;
+        if (lua_rawgetp(state, LUA_REGISTRYINDEX, &luaGlueDataKey) == LUA_TUSERDATA) {
+          data = static_cast<LuaGlueData *>(lua_touserdata(state, -1));
+          lua_pop(state, 1);
+        } else {
+          lua_pop(state, 1);
+          data = new (lua_newuserdatauv(state, sizeof(LuaGlueData), 0)) LuaGlueData();
+          lua_createtable(state, 0, 1);
+          lua_pushcfunction(state, destroyLuaGlueData);
+          lua_setfield(state, -2, "__gc");
+          lua_setmetatable(state, -2);
+          lua_rawsetp(state, LUA_REGISTRYINDEX, &luaGlueDataKey);
+        }
+        lua_rawgeti(state, LUA_REGISTRYINDEX, LUA_RIDX_MAINTHREAD);
+        *static_cast<LuaGlueData **>(lua_getextraspace(lua_tothread(state, -1))) = data;
+        lua_pop(state, 1);
+        *static_cast<LuaGlueData **>(lua_getextraspace(state)) = data;
+      }
+
+      /**
+       * Helpers for updating the boundary stats, which do nothing unless they are enabled.
+       */
+      namespace stats {
+
+        template <class F> void update(lua_State *state, F &&f) {
+          if constexpr (BoundaryStats::enabled) {
+            f(getLuaGlueData(state).stats);
+          }
+        }
+
+        /**
+         * Counts the value on top of the stack.
+         */
+        void countToLua(lua_State *state) {
+          update(state, [&](BoundaryStats &stats) {
+            stats.valuesToLua[size_t(lua_type(state, -1))]++;
+          });
+        }
+
+        void countFromLua(lua_State *state, int type) {
+          if (type < 0) return;
+          update(state, [&](BoundaryStats &stats) { stats.valuesFromLua[size_t(type)]++; });
+        }
+
+        /**
+         * Restores the conversion depth at the end of a protected call. Conversions interrupted
+         * by lua errors never finish, which would leave the depth raised and stop measuring all
+         * later conversions.
+         */
+        class DepthScope {
+        private:
+          LuaGlueData *data = nullptr;
+          unsigned depth = 0;
+
+        public:
+          explicit DepthScope(lua_State *state) {
+            if constexpr (BoundaryStats::enabled) {
+              data = &getLuaGlueData(state);
+              depth = data->conversionDepth;
+            }
+          }
+
+          DepthScope(const DepthScope &) = delete;
+
+          ~DepthScope() {
+            if constexpr (BoundaryStats::enabled) {
+              data->conversionDepth = depth;
+            }
+          }
+        };
+
+        /**
+         * Measures the time of the outermost conversion in its scope.
+         */
+        class ConversionTimer {
+        private:
+          LuaGlueData *data = nullptr;
+          std::chrono::steady_clock::time_point start;
+
+        public:
+          explicit ConversionTimer(lua_State *state) {
+            if constexpr (BoundaryStats::enabled) {
+              data = &getLuaGlueData(state);
+              if (data->conversionDepth++ == 0) start = std::chrono::steady_clock::now();
+            }
+          }
+
+          ConversionTimer(const ConversionTimer &) = delete;
+
+          ~ConversionTimer() {
+            if constexpr (BoundaryStats::enabled) {
+              if (--data->conversionDepth == 0) {
+                data->stats.conversionTime += std::chrono::steady_clock::now() - start;
+              }
+            }
+          }
+        };
+
+      }  // namespace stats
+
+      /**
+       * Keeps a lua string alive while it is referenced by a `StringRef`. The contents are
+       * copied when the state is destroyed.
+       */
+      class PinnedString final : public StringRef::Pin {
+      private:
+        struct Handle final : public ReferenceHandle {
+          PinnedString &pinned;
+          explicit Handle(PinnedString &p) : ReferenceHandle(p.reference), pinned(p) {}
+          void release() override {
+            pinned.copy.assign(pinned.string.data(), pinned.string.size());
+            pinned.string = pinned.copy;
+            ReferenceHandle::release();
+          }
+        };
+
+        std::string_view string;
+        std::string copy;
+
+      public:
+        sol::main_reference reference;
+        Handle handle{*this};
+
+        PinnedString(lua_State *state, int index) : reference(state, index) {
+          size_t size;
+          auto data = lua_tolstring(state, index, &size);
+          string = std::string_view(data, size);
+          handle.attach(state);
+        }
+
+        std::string_view contents() const override { return string; }
       };
 
-      LuaGlueData &getLuaGlueData(sol::state_view state) {
-        sol::table registry = state.registry();
-        constexpr auto key = "LuaGlueData";
-        sol::object data = registry[key];
-        if (!data) {
-          registry[key] = std::make_unique<LuaGlueData>();
-          data = registry[key];
+      /**
+       * Returns a reference to the string at the stack index without copying its contents.
+       */
+      StringRef makeStringRef(lua_State *state, int index) {
+        return StringRef(std::make_shared<PinnedString>(state, index));
+      }
+
+      // allows native function calls to skip the profiler lookup if no profiler is running
+      std::atomic<int> runningProfilers{0};
+
+      LuaGlueData::~LuaGlueData() {
+        if (profiler && profiler->running) runningProfilers--;
+        releaseHandles();
+      }
+
+      Profiler *getRunningProfiler(lua_State *state) {
+        if (runningProfilers.load(std::memory_order_relaxed) == 0) return nullptr;
+        auto &profiler = getLuaGlueData(state).profiler;
+        return profiler && profiler->running ? profiler.get() : nullptr;
+      }
+
+      /**
+       * Budgets and the profiler share a single count hook per lua thread, which is only
+       * installed while one of them is active.
+       */
+      namespace hooks {
+
+        void checkBudget(lua_State *state, ActiveBudget &active, int instructions) {
+          auto &budget = active.budget;
+          active.executed += size_t(instructions);
+          if (!active.exhausted) {
+            bool outOfInstructions
+                = budget.instructions > 0 && active.executed >= budget.instructions;
+            bool outOfTime = budget.time.count() > 0
+                             && std::chrono::steady_clock::now() >= active.deadline;
+            if (!outOfInstructions && !outOfTime) return;
+            active.exhausted = true;
+          }
+          // coroutines created by the script raise the error instead, as yielding them would
+          // return to the script rather than to C++
+          if (budget.action == Budget::Action::Suspend && state == active.thread
+              && lua_isyieldable(state)) {
+            lua_yield(state, 0);
+            return;
+          }
+          // check on every instruction from now on, so that scripts catching the error fail again
+          // as soon as the protected call returns and the error unwinds to C++
+          if (lua_gethookcount(state) != 1) {
+            lua_sethook(state, lua_gethook(state), lua_gethookmask(state), 1);
+          }
+          luaL_error(state, "lua budget exceeded");
+        }
+
+        /**
+         * Calls the application's hook for the events it requested. Count events are forwarded
+         * at the interval of the dispatcher.
+         */
+        void dispatch(lua_State *state, lua_Debug *ar) {
+          auto &data = getLuaGlueData(state);
+          auto foreign = data.foreignHook;
+          if (ar->event != LUA_HOOKCOUNT) {
+            if (foreign.hook) foreign.hook(state, ar);
+            return;
+          }
+          auto instructions = lua_gethookcount(state);
+          if (data.profiler && data.profiler->running) {
+            data.profiler->tick(state, instructions);
+          }
+          if (foreign.hook && (foreign.mask & LUA_MASKCOUNT)) {
+            foreign.hook(state, ar);
+          }
+          // budgets are checked last, as they may not return
+          if (data.activeBudget) {
+            checkBudget(state, *data.activeBudget, instructions);
+          }
+        }
+
+        /**
+         * Returns the hook of the application to restore on the thread, given the hook that is
+         * currently installed.
+         */
+        HookState foreignHook(const LuaGlueData &data, const HookState &installed) {
+          return installed.hook == dispatch ? data.foreignHook : installed;
         }
-        return data.as<LuaGlueData &>();
+
+        /**
+         * Installs the dispatcher on the thread if a budget or the profiler is active and
+         * restores the hook of the application otherwise.
+         */
+        void update(lua_State *thread, LuaGlueData &data, const HookState &foreign) {
+          size_t interval = 0;
+          if (data.activeBudget) {
+            interval = data.activeBudget->budget.checkInterval;
+          }
+          if (data.profiler && data.profiler->running) {
+            auto profilerInterval = std::max<size_t>(data.profiler->options.interval, 1);
+            interval = interval ? std::min(interval, profilerInterval) : profilerInterval;
+          }
+          if (interval > 0) {
+            data.foreignHook = foreign;
+            lua_sethook(thread, dispatch, LUA_MASKCOUNT | (foreign.hook ? foreign.mask : 0),
+                        int(std::min<size_t>(interval, INT_MAX)));
+          } else {
+            foreign.set(thread);
+          }
+        }
+
+        /**
+         * Activates the budget on the thread for the lifetime of the scope and marks the entry
+         * into lua for the profiler. Previous budgets are restored afterwards, so that scopes can
+         * be nested.
+         */
+        class Scope {
+        private:
+          lua_State *thread;
+          LuaGlueData *data = nullptr;
+          ActiveBudget active;
+          ActiveBudget *previous = nullptr;
+          HookState foreign;
+          bool limited;
+
+        public:
+          Scope(lua_State *t, const Budget &budget) : thread(t), limited(budget.isLimited()) {
+            auto profiler = getRunningProfiler(thread);
+            if (profiler) profiler->mark();
+            if (!limited && !profiler) return;
+            data = &getLuaGlueData(thread);
+            foreign = foreignHook(*data, HookState::get(thread));
+            if (limited) {
+              active.budget = budget;
+              active.thread = thread;
+              active.budget.checkInterval = std::max<size_t>(budget.checkInterval, 1);
+              active.deadline = std::chrono::steady_clock::now() + budget.time;
+              previous = data->activeBudget;
+              data->activeBudget = &active;
+            }
+            update(thread, *data, foreign);
+          }
+
+          Scope(const Scope &) = delete;
+
+          ~Scope() {
+            if (!data) return;
+            if (limited) data->activeBudget = previous;
+            // keep hooks installed by the script while the scope was active
+            if (lua_gethook(thread) != dispatch) return;
+            update(thread, *data, foreign);
+          }
+
+          bool exhausted() const { return active.exhausted; }
+
+          /**
+           * Runs `f`, rethrowing lua errors caused by the budget as `BudgetExceeded`.
+           */
+          template <class F> auto run(F &&f) {
+            try {
+              return f();
+            } catch (const sol::error &error) {
+              if (exhausted()) throw BudgetExceeded(error.what());
+              throw;
+            }
+          }
+        };
+
+      }  // namespace hooks
+
+      /**
+       * Enables or disables the memory limit of the state's `PoolAllocator` for the lifetime of
+       * the scope. The limit is only enforced while lua code runs in protected calls, so that
+       * memory errors never unwind C++ frames.
+       */
+      class MemoryLimitScope {
+      private:
+        PoolAllocator *allocator = nullptr;
+        bool previous = false;
+
+      public:
+        MemoryLimitScope(lua_State *state, bool enforce) {
+          void *userData = nullptr;
+          if (lua_getallocf(state, &userData) == &PoolAllocator::luaAllocate) {
+            allocator = static_cast<PoolAllocator *>(userData);
+            previous = allocator->enforceLimit(enforce);
+          }
+        }
+
+        MemoryLimitScope(const MemoryLimitScope &) = delete;
+
+        ~MemoryLimitScope() {
+          if (allocator) allocator->enforceLimit(previous);
+        }
+      };
+
+      Buffer *getBuffer(const sol::object &value) {
+        auto state = value.lua_state();
+        value.push(state);
+        auto result = stack::toBuffer(state, -1);
+        lua_pop(state, 1);
+        return result;
+      }
+
+      SharedData *getSharedData(const sol::object &value) {
+        auto state = value.lua_state();
+        value.push(state);
+        auto result = stack::toSharedData(state, -1);
+        lua_pop(state, 1);
+        return result;
       }
 
       struct LuaMap final : public revisited::DerivedVisitable<LuaMap, glue::Map> {
         sol::main_table data;
-        observe::Event<>::Observer lifetimeObserver;
+        ReferenceHandle handle{data};
 
-        LuaMap(sol::table t) : data(std::move(t)) {
-          if (data.lua_state())
-            lifetimeObserver = getLuaGlueData(data.lua_state()).onDestroy.createObserver([this]() {
-              data = sol::lua_nil;
-            });
+        LuaMap(sol::table t) : data(std::move(t)) { handle.attach(data.lua_state()); }
+
+        LuaMap(const LuaMap &other) : data(other.data) {
+          if (auto owner = other.handle.getOwner()) handle.attach(owner);
         }
 
-        LuaMap(const LuaMap &other) : LuaMap(other.data) {}
+        static int index(lua_State *state) {
+          lua_gettable(state, 1);
+          return 1;
+        }
 
         Any get(const std::string &key) const {
-          auto value = data[key];
-          if (value.valid()) {
-            return solToAny(data[key]);
-          } else {
-            return Any();
-          }
+          auto state = data.lua_state();
+          // `__index` metamethods, such as those of lazy modules, may raise errors
+          lua_pushcfunction(state, index);
+          data.push(state);
+          lua_pushlstring(state, key.data(), key.size());
+          callProtected(state, 2, 1);
+          auto result = stackToAny(state, -1);
+          lua_pop(state, 1);
+          return result;
         }
 
         void set(const std::string &key, const Any &value) {
@@ -74,6 +830,10 @@ namespace glue {
         }
 
         bool forEach(const std::function<bool(const std::string &)> &callback) const {
+          auto state = data.lua_state();
+          data.push(state);
+          lazy::materialize(state, lua_gettop(state));
+          lua_pop(state, 1);
           for (auto &&[k, v] : data) {
             if (k.is<std::string>()) {
               callback(k.as<std::string>());
@@ -83,31 +843,213 @@ namespace glue {
         }
       };
 
+      struct CoroutineData {
+        sol::main_reference reference;
+        ReferenceHandle handle{reference};
+        lua_State *thread = nullptr;
+        Coroutine::Status status = Coroutine::Status::Suspended;
+        std::string error;
+        std::optional<Budget> budget;
+        bool preempted = false;
+      };
+
+      /**
+       * Makes room for a function and its arguments on the stack.
+       */
+      void reserveArguments(lua_State *state, size_t arguments) {
+        if (arguments >= size_t(INT_MAX) || !lua_checkstack(state, int(arguments) + 1)) {
+          throw std::runtime_error("too many arguments");
+        }
+      }
+
       struct LuaFunction {
         sol::main_function data;
-        observe::Event<>::Observer lifetimeObserver;
+        ReferenceHandle handle{data};
 
-        LuaFunction(sol::function d) : data(std::move(d)) {
-          if (data.lua_state())
-            lifetimeObserver = getLuaGlueData(data.lua_state()).onDestroy.createObserver([this]() {
-              data = sol::function();
-            });
-        }
+        LuaFunction(sol::function d) : data(std::move(d)) { handle.attach(data.lua_state()); }
 
-        LuaFunction(const LuaFunction &other) : LuaFunction(other.data) {}
+        LuaFunction(const LuaFunction &other) : data(other.data) {
+          if (auto owner = other.handle.getOwner()) handle.attach(owner);
+        }
 
+        /**
+         * Calls the function in protected mode, limited by the budget of the state.
+         */
         Any operator()(const AnyArguments &args) const {
-          data.push();
           auto state = data.lua_state();
-          for (auto &arg : args) {
-            anyToSol(state, arg).push(state);
+          stats::update(state, [](BoundaryStats &stats) { stats.callsIntoLua++; });
+          reserveArguments(state, args.size());
+          hooks::Scope budget(state, getLuaGlueData(state).budget);
+          auto base = lua_gettop(state);
+          Any result;
+          try {
+            data.push(state);
+            for (auto &arg : args) {
+              pushAny(state, arg);
+            }
+            budget.run([&]() { callProtected(state, int(args.size()), 1); });
+            result = stackToAny(state, -1);
+          } catch (...) {
+            lua_settop(state, base);
+            throw;
+          }
+          lua_settop(state, base);
+          return result;
+        }
+
+        /**
+         * Calls the function in protected mode and returns all results.
+         */
+        Results call(const AnyArguments &args) const {
+          auto state = data.lua_state();
+          stats::update(state, [](BoundaryStats &stats) { stats.callsIntoLua++; });
+          if (auto profiler = getRunningProfiler(state)) profiler->mark();
+          reserveArguments(state, args.size());
+          auto base = lua_gettop(state);
+          Results results;
+          try {
+            data.push(state);
+            for (auto &arg : args) {
+              pushAny(state, arg);
+            }
+            callProtected(state, int(args.size()), LUA_MULTRET);
+            for (int index = base + 1, top = lua_gettop(state); index <= top; ++index) {
+              results.push_back(stackToAny(state, index));
+            }
+          } catch (...) {
+            lua_settop(state, base);
+            throw;
           }
-          lua_call(data.lua_state(), int(args.size()), 1);
-          return solToAny(sol::stack::pop<sol::object>(state));
+          lua_settop(state, base);
+          return results;
         }
       };
 
-      Any solToAny(sol::object value) {
+      /**
+       * Values of inline types are stored directly in userdata without a finalizer. Their
+       * metatables are copies of the class's instance metatable that reference the inline type.
+       */
+      namespace inlineValues {
+
+        // the addresses are used as unique registry and metatable keys
+        const char metatablesKey = 0;
+        const char typeKey = 0;
+        const char nameKey = 0;
+
+        const InlineType *getType(lua_State *state, int index) {
+          if (lua_type(state, index) != LUA_TUSERDATA || !lua_getmetatable(state, index)) {
+            return nullptr;
+          }
+          lua_rawgetp(state, -1, &typeKey);
+          auto type = static_cast<const InlineType *>(lua_touserdata(state, -1));
+          lua_pop(state, 2);
+          return type;
+        }
+
+        bool get(const sol::object &value, Any &result) {
+          auto state = value.lua_state();
+          value.push(state);
+          auto type = getType(state, -1);
+          if (type) {
+            result = type->load(lua_touserdata(state, -1));
+          }
+          lua_pop(state, 1);
+          return type != nullptr;
+        }
+
+        int toString(lua_State *state) {
+          if (!getType(state, 1)) {
+            return luaL_argerror(state, 1, "inline value expected");
+          }
+          // only lua values are used, as pushing the result may raise an error
+          lua_getmetatable(state, 1);
+          lua_rawgetp(state, -1, &nameKey);
+          lua_pushfstring(state, "%s(%p)", lua_tostring(state, -1), lua_touserdata(state, 1));
+          return 1;
+        }
+
+        /**
+         * Pushes the metatable for values of the type. Returns false if no class is registered
+         * for `value`.
+         */
+        bool pushMetatable(lua_State *state, const InlineType *type, const Any &value) {
+          if (lua_rawgetp(state, LUA_REGISTRYINDEX, &metatablesKey) != LUA_TTABLE) {
+            lua_pop(state, 1);
+            lua_newtable(state);
+            lua_pushvalue(state, -1);
+            lua_rawsetp(state, LUA_REGISTRYINDEX, &metatablesKey);
+          }
+          if (lua_rawgetp(state, -1, type) == LUA_TTABLE) {
+            lua_remove(state, -2);
+            return true;
+          }
+          lua_pop(state, 1);
+
+          auto instance = getLuaGlueData(state).context.createInstance(value);
+          if (!instance) {
+            lua_pop(state, 1);
+            return false;
+          }
+          instances::pushMetatable(state,
+                                   revisited::visitor_cast<LuaMap &>(**instance.classMap).data,
+                                   value.type().name);
+
+          // copy all fields except the finalizer and the instance marker
+          lua_newtable(state);
+          lua_pushnil(state);
+          while (lua_next(state, -3)) {
+            bool isMarker = lua_type(state, -2) == LUA_TLIGHTUSERDATA;
+            bool isFinalizer = lua_type(state, -2) == LUA_TSTRING
+                               && std::strcmp(lua_tostring(state, -2), "__gc") == 0;
+            if (isMarker || isFinalizer) {
+              lua_pop(state, 1);
+              continue;
+            }
+            if (lua_tocfunction(state, -1) == instances::toString) {
+              lua_pop(state, 1);
+              lua_pushcfunction(state, toString);
+            }
+            lua_pushvalue(state, -2);
+            lua_insert(state, -2);
+            lua_rawset(state, -4);
+          }
+          lua_pushlightuserdata(state, const_cast<InlineType *>(type));
+          lua_rawsetp(state, -2, &typeKey);
+          auto name = value.type().name;
+          lua_pushlstring(state, name.data(), name.size());
+          lua_rawsetp(state, -2, &nameKey);
+          lua_remove(state, -2);
+
+          // cache[type] = metatable
+          lua_pushvalue(state, -1);
+          lua_rawsetp(state, -3, type);
+          lua_remove(state, -2);
+          return true;
+        }
+
+        /**
+         * Pushes the value inline if its type is registered as inline type.
+         */
+        bool push(lua_State *state, const Any &value) {
+          for (auto &type : getLuaGlueData(state).inlineTypes) {
+            alignas(std::max_align_t) unsigned char buffer[State::maxInlineSize];
+            if (!type->store(value, buffer)) continue;
+            if (!pushMetatable(state, type.get(), value)) return false;
+            std::memcpy(lua_newuserdatauv(state, type->size, 0), buffer, type->size);
+            lua_pushvalue(state, -2);
+            lua_setmetatable(state, -2);
+            lua_remove(state, -2);
+            return true;
+          }
+          return false;
+        }
+
+      }  // namespace inlineValues
+
+      /**
+       * Converts the object without counting it in the boundary stats.
+       */
+      Any objectToAny(sol::object value) {
         if (!value.valid()) {
           return Any();
         }
@@ -141,6 +1083,14 @@ namespace glue {
           case sol::type::lightuserdata:
             if (value.is<sol::function>()) {
               goto function_case;
+            } else if (auto instance = instances::get(value)) {
+              return *instance;
+            } else if (Any inlineValue; inlineValues::get(value, inlineValue)) {
+              return inlineValue;
+            } else if (auto buffer = getBuffer(value)) {
+              return *buffer;
+            } else if (auto shared = getSharedData(value)) {
+              return *shared;
             } else if (value.is<Any>()) {
               return value.as<Any>();
             } else {
@@ -151,96 +1101,546 @@ namespace glue {
         }
       }
 
-      AnyArguments solArgsToAnyArgs(sol::variadic_args &vArgs) {
-        AnyArguments args;
-        for (auto &&arg : vArgs) {
-          args.push_back(solToAny(sol::object(arg)));
+      Any solToAny(sol::object value) {
+        if constexpr (BoundaryStats::enabled) {
+          if (value.valid()) {
+            auto state = value.lua_state();
+            stats::ConversionTimer timer(state);
+            stats::countFromLua(state, int(value.get_type()));
+            return objectToAny(std::move(value));
+          }
         }
-        return args;
+        return objectToAny(std::move(value));
       }
 
-      struct AnyToSolVisitor
-          : revisited::RecursiveVisitor<
-                const int16_t &, const uint16_t &, const int32_t &, const uint32_t &,
-                const int64_t &, double, bool, const std::string &, std::string, AnyFunction,
-                const glue::Map &, const LuaMap &, const LuaFunction &, sol::object> {
-        lua_State *state;
-        sol::object result;
-        MapCache *cache;
-
-        AnyToSolVisitor(lua_State *s, MapCache *c = nullptr) : state(s), cache(c) {}
+      struct ResultsVisitor : revisited::RecursiveVisitor<const Results &, const Yield &> {
+        const Results *result = nullptr;
+        bool yield = false;
 
-        bool visit(sol::object v) override {
-          result = std::move(v);
+        bool visit(const Results &v) override {
+          result = &v;
           return true;
         }
 
-        bool visit(const int16_t &v) override {
-          result = sol::make_object(state, v);
+        bool visit(const Yield &v) override {
+          result = &v.values;
+          yield = true;
           return true;
         }
+      };
 
-        bool visit(const uint16_t &v) override {
-          result = sol::make_object(state, v);
-          return true;
+      /**
+       * Pushes the value and returns the number of values pushed. `Results` are pushed as
+       * multiple values and `Yield` returns a marked result count.
+       */
+      int pushResults(lua_State *state, const Any &value) {
+        ResultsVisitor visitor;
+        if (value && value.accept(visitor)) {
+          auto count = stack::pushResults(state, *visitor.result);
+          return visitor.yield ? count + stack::yieldMarker : count;
         }
+        pushAny(state, value);
+        return 1;
+      }
 
-        bool visit(const int32_t &v) override {
-          result = sol::make_object(state, v);
-          return true;
+      /**
+       * Calls an `AnyFunction` with all arguments on the stack and pushes its results.
+       */
+      int invokeAnyFunction(void *function, lua_State *state) {
+        AnyArguments args;
+        for (int index = 1, top = lua_gettop(state); index <= top; ++index) {
+          args.push_back(stackToAny(state, index));
         }
+        return pushResults(state, static_cast<AnyFunction *>(function)->call(args));
+      }
 
-        bool visit(const uint32_t &v) override {
-          result = sol::make_object(state, v);
+      void destroyAnyFunction(void *function) { delete static_cast<AnyFunction *>(function); }
+
+      struct MapVisitor : revisited::RecursiveVisitor<const glue::Map &> {
+        const glue::Map *result = nullptr;
+
+        bool visit(const glue::Map &v) override {
+          result = &v;
           return true;
         }
+      };
 
-        bool visit(const int64_t &v) override {
-          result = sol::make_object(state, v);
-          return true;
+      // the name of the owner metatable
+      constexpr auto ownerMetatableName = "LuaGlueOwner";
+
+      int destroyOwner(lua_State *state) {
+        auto value = static_cast<Any *>(luaL_checkudata(state, 1, ownerMetatableName));
+        value->~Any();
+        // leave a valid object in case the finalizer is called again
+        new (value) Any();
+        return 0;
+      }
+
+      /**
+       * Pushes userdata containing a copy of `value`, keeping the contained object alive until
+       * the userdata is collected.
+       */
+      void pushOwner(lua_State *state, const Any &value) {
+        new (lua_newuserdatauv(state, sizeof(Any), 0)) Any(value);
+        if (luaL_newmetatable(state, ownerMetatableName)) {
+          lua_pushcfunction(state, destroyOwner);
+          lua_setfield(state, -2, "__gc");
+          // hides the finalizer from `getmetatable`
+          lua_pushstring(state, ownerMetatableName);
+          lua_setfield(state, -2, "__metatable");
         }
+        lua_setmetatable(state, -2);
+      }
 
-        bool visit(double v) override {
-          result = sol::make_object(state, v);
-          return true;
+      /**
+       * Remembers the tables converted from C++ maps, so that the same map is always converted to
+       * the same table. Tables are referenced weakly and keep their source map alive, so that the
+       * address of a map cannot be reused while its table exists.
+       */
+      namespace identity {
+
+        // the addresses are used as unique registry keys
+        const char tablesKey = 0;
+        const char ownersKey = 0;
+
+        /**
+         * Pushes the registry table with the given key, creating it with the given weak mode.
+         */
+        void pushWeakTable(lua_State *state, const char *key, const char *mode) {
+          if (lua_rawgetp(state, LUA_REGISTRYINDEX, key) == LUA_TTABLE) return;
+          lua_pop(state, 1);
+          lua_newtable(state);
+          lua_createtable(state, 0, 1);
+          lua_pushstring(state, mode);
+          lua_setfield(state, -2, "__mode");
+          lua_setmetatable(state, -2);
+          lua_pushvalue(state, -1);
+          lua_rawsetp(state, LUA_REGISTRYINDEX, key);
         }
 
-        bool visit(bool v) override {
-          result = sol::make_object(state, v);
+        /**
+         * Pushes the table previously converted from `map` and returns true if it exists.
+         */
+        bool push(lua_State *state, const glue::Map *map) {
+          pushWeakTable(state, &tablesKey, "v");
+          if (lua_rawgetp(state, -1, map) == LUA_TNIL) {
+            lua_pop(state, 2);
+            return false;
+          }
+          lua_remove(state, -2);
           return true;
         }
 
-        bool visit(std::string v) override {
-          result = sol::make_object(state, std::move(v));
-          return true;
+        /**
+         * Remembers the table on top of the stack as the conversion of `map`, which is kept
+         * alive by `owner`.
+         */
+        void store(lua_State *state, const glue::Map *map, const Any &owner) {
+          pushWeakTable(state, &tablesKey, "v");
+          lua_pushvalue(state, -2);
+          lua_rawsetp(state, -2, map);
+          lua_pop(state, 1);
+          pushWeakTable(state, &ownersKey, "k");
+          lua_pushvalue(state, -2);
+          pushOwner(state, owner);
+          lua_rawset(state, -3);
+          lua_pop(state, 1);
         }
 
-        bool visit(const std::string &v) override {
-          result = sol::make_object(state, v);
-          return true;
+        /**
+         * Forgets the table converted from `map`. The table itself remains valid.
+         */
+        void remove(lua_State *state, const glue::Map *map) {
+          pushWeakTable(state, &tablesKey, "v");
+          lua_pushnil(state);
+          lua_rawsetp(state, -2, map);
+          lua_pop(state, 1);
         }
 
-        bool visit(const LuaFunction &v) override {
-          result = sol::function(state, v.data);
-          return true;
+      }  // namespace identity
+
+      /**
+       * Lazy modules are exposed as empty proxy tables. Their metatable converts entries of the
+       * module on first access and caches them in the proxy using raw sets. Entries missing in
+       * the module are looked up in an optional fallback table, which allows chaining modules.
+       * Keys missing in both are remembered in the metatable, so that repeated lookups of
+       * undefined globals do not call into C++ again. Adding a module replaces the metatable and
+       * with it the remembered keys.
+       */
+      namespace lazy {
+
+        // the addresses are used as unique metatable keys
+        const char mapKey = 0;
+        const char fallbackKey = 0;
+        const char missingKey = 0;
+
+        // limits the memory used by scripts looking up many different undefined keys
+        constexpr lua_Integer maxMissingKeys = 1024;
+
+        /**
+         * Returns true if the key is known to be missing in the proxy with the metatable.
+         */
+        bool isMissing(lua_State *state, int metatable, int key) {
+          if (lua_rawgetp(state, metatable, &missingKey) != LUA_TTABLE) {
+            lua_pop(state, 1);
+            return false;
+          }
+          lua_pushvalue(state, key);
+          bool missing = lua_rawget(state, -2) != LUA_TNIL;
+          lua_pop(state, 2);
+          return missing;
         }
 
-        bool visit(AnyFunction f) override {
-          result = sol::make_object(state, [f = std::move(f)](sol::variadic_args vArgs) {
-            return anyToSol(vArgs.lua_state(), f.call(solArgsToAnyArgs(vArgs)));
-          });
-          return true;
+        /**
+         * Remembers that the key is missing. The keys are counted at index 0 of the table, which
+         * is replaced once it is full.
+         */
+        void setMissing(lua_State *state, int metatable, int key) {
+          lua_Integer count = 0;
+          if (lua_rawgetp(state, metatable, &missingKey) == LUA_TTABLE) {
+            lua_rawgeti(state, -1, 0);
+            count = lua_tointeger(state, -1);
+            lua_pop(state, 1);
+          }
+          if (count == 0 || count >= maxMissingKeys) {
+            lua_pop(state, 1);
+            lua_newtable(state);
+            lua_pushvalue(state, -1);
+            lua_rawsetp(state, metatable, &missingKey);
+            count = 0;
+          }
+          lua_pushinteger(state, count + 1);
+          lua_rawseti(state, -2, 0);
+          lua_pushvalue(state, key);
+          lua_pushboolean(state, 1);
+          lua_rawset(state, -3);
+          lua_pop(state, 1);
         }
 
-        bool visit(const LuaMap &v) override {
-          result = sol::table(state, v.data);
+        /**
+         * Returns the module of the proxy table or `nullptr` if the table is not a proxy.
+         */
+        const glue::Map *getMap(lua_State *state, int table) {
+          if (!lua_getmetatable(state, table)) return nullptr;
+          lua_rawgetp(state, -1, &mapKey);
+          auto value = static_cast<Any *>(lua_touserdata(state, -1));
+          lua_pop(state, 2);
+          MapVisitor visitor;
+          if (value && *value) value->accept(visitor);
+          return visitor.result;
+        }
+
+        /**
+         * Converts the entry of the module and caches it in the proxy. Returns false if the
+         * module contains no such entry.
+         */
+        bool convertEntry(lua_State *state, const glue::Map &map, int table, int key) {
+          size_t size;
+          auto name = lua_tolstring(state, key, &size);
+          auto value = map.get(std::string(name, size));
+          if (!value) return false;
+          pushAny(state, value, nullptr, true);
+          lua_pushvalue(state, key);
+          lua_pushvalue(state, -2);
+          lua_rawset(state, table);
           return true;
         }
 
-        bool visit(const glue::Map &v) override {
-          if (auto it = cache ? easy_iterator::find(*cache, &v) : nullptr) {
-            result = it->second;
+        int index(lua_State *state) {
+          lua_settop(state, 2);
+          lua_getmetatable(state, 1);
+          bool isString = lua_type(state, 2) == LUA_TSTRING;
+          if (isString && isMissing(state, 3, 2)) {
+            lua_pushnil(state);
+            return 1;
+          }
+
+          bool found = false;
+          bool failed = false;
+          if (isString) {
+            // C++ exceptions are converted to lua errors outside of the catch block
+            try {
+              MemoryLimitScope limit(state, false);
+              if (auto map = getMap(state, 1)) found = convertEntry(state, *map, 1, 2);
+            } catch (const std::exception &error) {
+              lua_pushstring(state, error.what());
+              failed = true;
+            } catch (...) {
+              lua_pushstring(state, "unknown C++ exception");
+              failed = true;
+            }
+          }
+          if (failed) return lua_error(state);
+          if (found) return 1;
+
+          if (lua_rawgetp(state, 3, &fallbackKey) != LUA_TNIL) {
+            lua_pushvalue(state, 2);
+            if (lua_gettable(state, -2) != LUA_TNIL) {
+              lua_pushvalue(state, 2);
+              lua_pushvalue(state, -2);
+              lua_rawset(state, 1);
+              return 1;
+            }
+          }
+          if (isString) setMissing(state, 3, 2);
+          lua_pushnil(state);
+          return 1;
+        }
+
+        void materialize(lua_State *state, int table) {
+          if (auto map = getMap(state, table)) {
+            map->forEach([&](const std::string &key) {
+              lua_pushlstring(state, key.data(), key.size());
+              if (lua_rawget(state, table) == LUA_TNIL) {
+                lua_pushlstring(state, key.data(), key.size());
+                if (convertEntry(state, *map, table, lua_gettop(state))) lua_pop(state, 1);
+                lua_pop(state, 1);
+              }
+              lua_pop(state, 1);
+              return false;
+            });
+          } else {
+            return;
+          }
+
+          lua_getmetatable(state, table);
+          if (lua_rawgetp(state, -1, &fallbackKey) == LUA_TTABLE) {
+            auto fallback = lua_gettop(state);
+            materialize(state, fallback);
+            lua_pushnil(state);
+            while (lua_next(state, fallback)) {
+              lua_pushvalue(state, -2);
+              if (lua_rawget(state, table) == LUA_TNIL) {
+                lua_pushvalue(state, -3);
+                lua_pushvalue(state, -3);
+                lua_rawset(state, table);
+              }
+              lua_pop(state, 2);
+            }
+          }
+          lua_pop(state, 2);
+        }
+
+        int next(lua_State *state) {
+          lua_settop(state, 2);
+          if (lua_next(state, 1)) return 2;
+          lua_pushnil(state);
+          return 1;
+        }
+
+        int pairs(lua_State *state) {
+          bool failed = false;
+          try {
+            MemoryLimitScope limit(state, false);
+            materialize(state, 1);
+          } catch (const std::exception &error) {
+            lua_pushstring(state, error.what());
+            failed = true;
+          } catch (...) {
+            lua_pushstring(state, "unknown C++ exception");
+            failed = true;
+          }
+          if (failed) return lua_error(state);
+          lua_pushcfunction(state, next);
+          lua_pushvalue(state, 1);
+          lua_pushnil(state);
+          return 3;
+        }
+
+        /**
+         * Pushes a metatable converting entries of the module contained in `map`.
+         */
+        void pushMetatable(lua_State *state, const Any &map) {
+          lua_createtable(state, 0, 5);
+          pushOwner(state, map);
+          lua_rawsetp(state, -2, &mapKey);
+          lua_pushcfunction(state, index);
+          lua_setfield(state, -2, "__index");
+          lua_pushcfunction(state, pairs);
+          lua_setfield(state, -2, "__pairs");
+          // hides the module owner from `getmetatable`
+          lua_pushliteral(state, "LuaGlueModule");
+          lua_setfield(state, -2, "__metatable");
+        }
+
+        /**
+         * Makes the table at `table` a proxy of the module. If the table is already a proxy, the
+         * previous module is used as a fallback. Returns false if the table has a different
+         * metatable.
+         */
+        bool extend(lua_State *state, int table, const Any &map) {
+          if (lua_getmetatable(state, table)) {
+            bool isProxy = lua_rawgetp(state, -1, &mapKey) != LUA_TNIL;
+            lua_pop(state, 1);
+            if (!isProxy) {
+              lua_pop(state, 1);
+              return false;
+            }
+            lua_newtable(state);
+            lua_insert(state, -2);
+            lua_setmetatable(state, -2);
+          } else {
+            lua_pushnil(state);
+          }
+          pushMetatable(state, map);
+          lua_insert(state, -2);
+          lua_rawsetp(state, -2, &fallbackKey);
+          lua_setmetatable(state, table);
+          return true;
+        }
+
+      }  // namespace lazy
+
+      /**
+       * Pushes the visited value directly onto the lua stack.
+       */
+      struct AnyToSolVisitor
+          : revisited::RecursiveVisitor<
+                const int16_t &, const uint16_t &, const int32_t &, const uint32_t &,
+                const int64_t &, double, bool, const std::string &, std::string, AnyFunction,
+                const glue::Map &, const LuaMap &, const LuaFunction &, sol::object,
+                const std::vector<double> &, const std::vector<int64_t> &,
+                const std::vector<std::string> &, const Buffer &, const StringRef &,
+                const SharedData &> {
+        lua_State *state;
+        MapCache *cache;
+        bool lazy;
+        const Any *source = nullptr;
+
+        /**
+         * Creates a preallocated array table and fills it using raw sets.
+         */
+        template <class T, class Push> void pushSequence(const std::vector<T> &values, Push push) {
+          lua_createtable(state, int(values.size()), 0);
+          lua_Integer index = 1;
+          for (auto &value : values) {
+            push(value);
+            lua_rawseti(state, -2, index++);
+          }
+        }
+
+        bool visit(const StringRef &v) override {
+          auto pinned = dynamic_cast<const PinnedString *>(v.pinned().get());
+          // references are empty if the string belongs to a closed state
+          if (pinned && pinned->handle.getOwner() == &getLuaGlueData(state)) {
+            pinned->reference.push(state);
+          } else {
+            lua_pushlstring(state, v.data(), v.size());
+          }
+          return true;
+        }
+
+        bool visit(const Buffer &v) override {
+          stack::pushBuffer(state, v);
+          return true;
+        }
+
+        bool visit(const SharedData &v) override {
+          stack::pushSharedData(state, v);
+          return true;
+        }
+
+        bool visit(const std::vector<double> &v) override {
+          pushSequence(v, [this](double value) { lua_pushnumber(state, value); });
+          return true;
+        }
+
+        bool visit(const std::vector<int64_t> &v) override {
+          pushSequence(v, [this](int64_t value) { lua_pushinteger(state, value); });
+          return true;
+        }
+
+        bool visit(const std::vector<std::string> &v) override {
+          pushSequence(v, [this](const std::string &value) {
+            lua_pushlstring(state, value.data(), value.size());
+          });
+          return true;
+        }
+
+        AnyToSolVisitor(lua_State *s, MapCache *c = nullptr, bool l = false)
+            : state(s), cache(c), lazy(l) {}
+
+        bool visit(sol::object v) override {
+          v.push(state);
+          return true;
+        }
+
+        bool visit(const int16_t &v) override {
+          lua_pushinteger(state, v);
+          return true;
+        }
+
+        bool visit(const uint16_t &v) override {
+          lua_pushinteger(state, v);
+          return true;
+        }
+
+        bool visit(const int32_t &v) override {
+          lua_pushinteger(state, v);
+          return true;
+        }
+
+        bool visit(const uint32_t &v) override {
+          lua_pushinteger(state, v);
+          return true;
+        }
+
+        bool visit(const int64_t &v) override {
+          lua_pushinteger(state, v);
+          return true;
+        }
+
+        bool visit(double v) override {
+          lua_pushnumber(state, v);
+          return true;
+        }
+
+        bool visit(bool v) override {
+          lua_pushboolean(state, v);
+          return true;
+        }
+
+        bool visit(std::string v) override {
+          lua_pushlstring(state, v.data(), v.size());
+          return true;
+        }
+
+        bool visit(const std::string &v) override {
+          lua_pushlstring(state, v.data(), v.size());
+          return true;
+        }
+
+        bool visit(const LuaFunction &v) override {
+          v.data.push(state);
+          return true;
+        }
+
+        bool visit(AnyFunction f) override {
+          auto function = std::make_unique<AnyFunction>(std::move(f));
+          stack::pushFunction(state, function.get(), &invokeAnyFunction, &destroyAnyFunction);
+          function.release();
+          return true;
+        }
+
+        bool visit(const LuaMap &v) override {
+          v.data.push(state);
+          return true;
+        }
+
+        bool visit(const glue::Map &v) override {
+          bool keepIdentity = lazy || getLuaGlueData(state).cacheMaps;
+          if (keepIdentity && identity::push(state, &v)) {
+            return true;
+          }
+
+          if (lazy && !v.get(keys::classKey)) {
+            lua_newtable(state);
+            lazy::pushMetatable(state, *source);
+            lua_setmetatable(state, -2);
+          } else if (auto it = cache ? easy_iterator::find(*cache, &v) : nullptr) {
+            it->second.push(state);
           } else {
+            stats::update(state, [](BoundaryStats &stats) { stats.tablesCopied++; });
             sol::table table(state, sol::create);
 
             if (auto classInfo = v.get(keys::classKey)) {
@@ -265,54 +1665,811 @@ namespace glue {
               (*cache)[&v] = table;
             }
 
-            result = std::move(table);
+            table.push(state);
+          }
+
+          if (keepIdentity) {
+            identity::store(state, &v, *source);
           }
           return true;
         }
       };
 
-      sol::object anyToSol(lua_State *state, const Any &value, MapCache *cache) {
+      /**
+       * Converts the classes of lazily added modules, registering them for instances. Returns
+       * false if there are no such modules.
+       */
+      bool resolvePendingClasses(lua_State *state) {
+        auto &data = getLuaGlueData(state);
+        if (data.pendingModules.empty()) return false;
+        // taken out first, as converting classes may convert instances again
+        auto modules = std::move(data.pendingModules);
+        data.pendingModules.clear();
+        MapCache cache;
+        for (auto &module : modules) {
+          glue::Context context;
+          context.addRootMap(module);
+          for (auto &&id : context.uniqueTypes) {
+            pushAny(state, context.types[id.index].data.data, &cache, true);
+            lua_pop(state, 1);
+          }
+        }
+        return true;
+      }
+
+      void pushAny(lua_State *state, const Any &value, MapCache *cache, bool lazy) {
+        stats::ConversionTimer timer(state);
         if (!value) {
-          return sol::lua_nil;
+          lua_pushnil(state);
+          stats::countToLua(state);
+          return;
         }
 
-        AnyToSolVisitor visitor(state, cache);
-        if (value.accept(visitor)) {
-          return visitor.result;
-        } else {
+        AnyToSolVisitor visitor(state, cache, lazy);
+        visitor.source = &value;
+        if (!value.accept(visitor) && !inlineValues::push(state, value)) {
           auto &data = getLuaGlueData(state);
           auto instance = data.context.createInstance(value);
+          if (!instance && resolvePendingClasses(state)) {
+            instance = data.context.createInstance(value);
+          }
           if (instance) {
             auto &luaTable = revisited::visitor_cast<LuaMap &>(**instance.classMap);
-            return sol::make_object(state,
-                                    LuaGlueInstance{std::move(instance.data), luaTable.data});
+            instances::push(state, std::move(instance.data), luaTable.data);
+            stats::update(state, [](BoundaryStats &stats) { stats.instancesCreated++; });
           } else {
-            return sol::make_object(state, value);
+            sol::stack::push(state, value);
+          }
+        }
+        stats::countToLua(state);
+      }
+
+      sol::object anyToSol(lua_State *state, const Any &value, MapCache *cache, bool lazy) {
+        pushAny(state, value, cache, lazy);
+        return sol::stack::pop<sol::object>(state);
+      }
+
+      Any stackToAny(lua_State *state, int index) {
+        stats::ConversionTimer timer(state);
+        auto type = lua_type(state, index);
+        stats::countFromLua(state, type);
+        switch (type) {
+          case LUA_TNONE:
+          case LUA_TNIL:
+            return Any();
+          case LUA_TBOOLEAN:
+            return bool(lua_toboolean(state, index));
+          case LUA_TSTRING: {
+            size_t size;
+            auto string = lua_tolstring(state, index, &size);
+            return std::string(string, size);
           }
+          case LUA_TNUMBER:
+            if (sol::stack::check<int64_t>(state, index)) {
+              return int64_t(lua_tointeger(state, index));
+            } else {
+              return double(lua_tonumber(state, index));
+            }
+          case LUA_TUSERDATA:
+            if (auto value = instances::get(state, index)) {
+              return *value;
+            }
+            if (auto buffer = stack::toBuffer(state, index)) {
+              return *buffer;
+            }
+            if (auto shared = stack::toSharedData(state, index)) {
+              return *shared;
+            }
+            if (auto type = inlineValues::getType(state, index)) {
+              return type->load(lua_touserdata(state, index));
+            }
+            return objectToAny(sol::object(state, index));
+          default:
+            return objectToAny(sol::object(state, index));
         }
       }
 
+      struct LuaMapVisitor : revisited::RecursiveVisitor<const LuaMap &> {
+        const LuaMap *result = nullptr;
+
+        bool visit(const LuaMap &v) override {
+          result = &v;
+          return true;
+        }
+      };
+
+      struct LuaFunctionVisitor : revisited::RecursiveVisitor<const LuaFunction &> {
+        const LuaFunction *result = nullptr;
+
+        bool visit(const LuaFunction &v) override {
+          result = &v;
+          return true;
+        }
+      };
+
+      /**
+       * Calls the function on top of the stack in protected mode and returns the first result.
+       * Errors are rethrown as `sol::error`.
+       */
+      sol::object protectedCall(lua_State *state, int nargs) {
+        callProtected(state, nargs, 1);
+        return sol::stack::pop<sol::object>(state);
+      }
+
+      /**
+       * A lua error raised with a value other than a string or number. The value is kept in the
+       * registry, so that native functions can raise the original value again when the error
+       * passes through them.
+       */
+      class ErrorObject : public sol::error {
+      private:
+        struct Reference {
+          sol::main_reference value;
+          ReferenceHandle handle{value};
+
+          Reference(lua_State *state, int index) : value(state, index) {
+            handle.attach(state);
+          }
+        };
+
+        std::shared_ptr<Reference> reference;
+
+      public:
+        ErrorObject(lua_State *state, int index)
+            : sol::error(std::string("error object is a ") + luaL_typename(state, index)
+                         + " value"),
+              reference(std::make_shared<Reference>(state, index)) {}
+
+        /**
+         * Pushes the original value, or the message if the state is being destroyed.
+         */
+        void push(lua_State *state) const {
+          if (reference->value.valid()) {
+            reference->value.push(state);
+          } else {
+            lua_pushstring(state, what());
+          }
+        }
+      };
+
+      void callProtected(lua_State *state, int nargs, int nresults) {
+        stats::DepthScope depth(state);
+        int status;
+        {
+          MemoryLimitScope limit(state, true);
+          status = lua_pcall(state, nargs, nresults, 0);
+        }
+        if (status != LUA_OK) {
+          auto type = lua_type(state, -1);
+          if (type != LUA_TSTRING && type != LUA_TNUMBER) {
+            ErrorObject error(state, -1);
+            lua_pop(state, 1);
+            throw error;
+          }
+          std::string error = lua_tostring(state, -1);
+          lua_pop(state, 1);
+          throw sol::error(error);
+        }
+      }
+
+      /**
+       * Protected calls reporting errors as `ScriptError` instead of exceptions.
+       */
+      namespace errors {
+
+        // the address is used as a unique registry key
+        const char tracebackKey = 0;
+
+        /**
+         * Records the location of the error and the traceback if enabled. Runs inside of lua, so
+         * it must not allocate C++ memory.
+         */
+        int handler(lua_State *state) {
+          auto &error = getLuaGlueData(state).lastError;
+          lua_Debug ar;
+          for (int level = 1; lua_getstack(state, level, &ar); ++level) {
+            lua_getinfo(state, "Sl", &ar);
+            if (ar.currentline >= 0) {
+              std::memcpy(error.chunk, ar.short_src, sizeof(error.chunk));
+              error.line = ar.currentline;
+              break;
+            }
+          }
+          if (error.tracebacks) {
+            luaL_traceback(state, state, nullptr, 1);
+            lua_rawsetp(state, LUA_REGISTRYINDEX, &tracebackKey);
+          }
+          return 1;
+        }
+
+        ScriptError view(const ErrorStorage &error) {
+          ScriptError result;
+          result.message = error.message;
+          result.traceback = error.traceback;
+          result.chunk = error.chunk;
+          result.line = error.line;
+          return result;
+        }
+
+        /**
+         * Moves the error on top of the stack into the error buffers.
+         */
+        ScriptError pop(lua_State *state, ErrorStorage &error) {
+          auto type = lua_type(state, -1);
+          if (type == LUA_TSTRING || type == LUA_TNUMBER) {
+            size_t length = 0;
+            auto message = lua_tolstring(state, -1, &length);
+            error.message.assign(message, length);
+          } else {
+            error.message.assign("error object is a ");
+            error.message.append(lua_typename(state, type));
+            error.message.append(" value");
+          }
+          lua_pop(state, 1);
+
+          error.traceback.clear();
+          if (error.tracebacks) {
+            if (lua_rawgetp(state, LUA_REGISTRYINDEX, &tracebackKey) == LUA_TSTRING) {
+              size_t length = 0;
+              auto traceback = lua_tolstring(state, -1, &length);
+              error.traceback.assign(traceback, length);
+            }
+            lua_pop(state, 1);
+            lua_pushnil(state);
+            lua_rawsetp(state, LUA_REGISTRYINDEX, &tracebackKey);
+          }
+          return view(error);
+        }
+
+        ScriptError fromException(ErrorStorage &error, const std::exception &exception) {
+          error.message.assign(exception.what());
+          error.traceback.clear();
+          error.chunk[0] = 0;
+          error.line = -1;
+          return view(error);
+        }
+
+        /**
+         * Calls the function below the arguments using the message handler. Returns false and
+         * sets `result` if the call fails.
+         */
+        bool call(lua_State *state, int nargs, int nresults, ScriptError &result) {
+          auto &error = getLuaGlueData(state).lastError;
+          // the handler is not called for memory errors
+          error.chunk[0] = 0;
+          error.line = -1;
+          auto handlerIndex = lua_gettop(state) - nargs;
+          lua_pushcfunction(state, handler);
+          lua_insert(state, handlerIndex);
+          stats::DepthScope depth(state);
+          int status;
+          {
+            MemoryLimitScope limit(state, true);
+            status = lua_pcall(state, nargs, nresults, handlerIndex);
+          }
+          lua_remove(state, handlerIndex);
+          if (status == LUA_OK) {
+            return true;
+          }
+          result = pop(state, error);
+          return false;
+        }
+
+      }  // namespace errors
+
+      /**
+       * Compiles the code without running it. Syntax errors are rethrown as `sol::error`.
+       */
+      sol::main_function compileChunk(lua_State *state, const std::string_view &code,
+                                      const std::string &name) {
+        if (luaL_loadbufferx(state, code.data(), code.size(), name.c_str(), nullptr) != LUA_OK) {
+          const char *message = lua_tostring(state, -1);
+          std::string error = message ? message : "unknown lua error";
+          lua_pop(state, 1);
+          throw sol::error(error);
+        }
+        return sol::stack::pop<sol::main_function>(state);
+      }
+
+      /**
+       * A least recently used cache of compiled chunks, keyed by chunk name and source.
+       */
+      class ChunkCache {
+      private:
+        struct Entry {
+          std::string key;
+          sol::main_function function;
+        };
+
+        std::list<Entry> entries;
+        std::unordered_map<std::string_view, std::list<Entry>::iterator> index;
+        std::string keyBuffer;
+        sol::main_function uncached;
+
+        void evict() {
+          while (entries.size() > stats.capacity) {
+            index.erase(entries.back().key);
+            entries.pop_back();
+            stats.evictions++;
+          }
+          stats.size = entries.size();
+        }
+
+      public:
+        ChunkCacheStats stats;
+
+        ChunkCache() { stats.capacity = 256; }
+
+        const sol::main_function &load(lua_State *state, const std::string_view &code,
+                                       const std::string &name) {
+          return load(state, std::string_view(), code, name);
+        }
+
+        /**
+         * Loads the concatenation of `prefix` and `code`, which is only built in the reused key
+         * buffer so that cache hits do not allocate.
+         */
+        const sol::main_function &load(lua_State *state, const std::string_view &prefix,
+                                       const std::string_view &code, const std::string &name) {
+          // the name is prefixed with its length so that keys are unambiguous
+          auto nameSize = name.size();
+          keyBuffer.assign(reinterpret_cast<const char *>(&nameSize), sizeof(nameSize));
+          keyBuffer.append(name);
+          auto codeOffset = keyBuffer.size();
+          keyBuffer.append(prefix);
+          keyBuffer.append(code);
+
+          if (auto it = index.find(keyBuffer); it != index.end()) {
+            stats.hits++;
+            entries.splice(entries.begin(), entries, it->second);
+            return it->second->function;
+          }
+
+          stats.misses++;
+          // the key is copied as finalizers running during compilation may reuse the buffer
+          auto key = keyBuffer;
+          auto function = compileChunk(state, std::string_view(key).substr(codeOffset), name);
+
+          if (stats.capacity == 0) {
+            uncached = std::move(function);
+            return uncached;
+          }
+
+          entries.push_front(Entry{std::move(key), std::move(function)});
+          index.emplace(entries.front().key, entries.begin());
+          evict();
+          return entries.front().function;
+        }
+
+        void setCapacity(size_t capacity) {
+          stats.capacity = capacity;
+          evict();
+        }
+
+        void clear() {
+          index.clear();
+          entries.clear();
+          uncached = sol::main_function();
+          stats.size = 0;
+        }
+      };
+
+      uint64_t hashBytes(const std::string_view &bytes) {
+        // 64 bit FNV-1a
+        uint64_t hash = 14695981039346656037ull;
+        for (auto c : bytes) {
+          hash ^= uint64_t(uint8_t(c));
+          hash *= 1099511628211ull;
+        }
+        return hash;
+      }
+
+      bool readFile(const std::filesystem::path &path, std::string &result) {
+        std::ifstream file(path, std::ios::binary);
+        if (!file) return false;
+        std::stringstream stream;
+        stream << file.rdbuf();
+        result = stream.str();
+        return bool(file);
+      }
+
+      /**
+       * Header of files in the bytecode cache, followed by the bytecode itself.
+       */
+      struct BytecodeHeader {
+        char magic[8] = {'L', 'G', 'B', 'C', 'v', '2', '\0', '\0'};
+        uint64_t sourceSize = 0;
+        uint64_t sourceHash = 0;
+        uint64_t bytecodeHash = 0;
+      };
+
+      /**
+       * Writes the file to a temporary path and moves it into place, so that concurrent readers
+       * will never see a partially written file.
+       */
+      void writeFileAtomically(const std::filesystem::path &path, const BytecodeHeader &header,
+                               const std::string_view &bytecode) {
+        static std::atomic<uint64_t> counter{0};
+        auto unique = std::hash<std::thread::id>()(std::this_thread::get_id())
+                      ^ uint64_t(std::chrono::steady_clock::now().time_since_epoch().count())
+                      ^ counter++;
+        auto temporary = path;
+        temporary += ".tmp" + std::to_string(unique);
+
+        std::error_code error;
+        {
+          std::ofstream file(temporary, std::ios::binary | std::ios::trunc);
+          file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+          file.write(bytecode.data(), bytecode.size());
+          if (!file) {
+            file.close();
+            std::filesystem::remove(temporary, error);
+            return;
+          }
+        }
+        std::filesystem::rename(temporary, path, error);
+        if (error) {
+          std::filesystem::remove(temporary, error);
+        }
+      }
+
+      bool loadBytecode(lua_State *state, const std::string_view &bytecode,
+                        const std::string &chunkName) {
+        if (luaL_loadbufferx(state, bytecode.data(), bytecode.size(), chunkName.c_str(), "b")
+            != LUA_OK) {
+          lua_pop(state, 1);
+          return false;
+        }
+        return true;
+      }
+
+      /**
+       * Pushes the compiled chunk of the file at path, using the bytecode cache in `directory`.
+       * Cached bytecode is only loaded if the hash of the source matches the one it was compiled
+       * from and the bytecode itself is intact, so that edits and truncated files are detected
+       * regardless of modification times.
+       */
+      void loadCachedFile(lua_State *state, const std::string &path,
+                          const std::filesystem::path &directory) {
+        namespace fs = std::filesystem;
+
+        std::string source;
+        if (!readFile(path, source)) {
+          throw sol::error("cannot open " + path);
+        }
+        BytecodeHeader current;
+        current.sourceSize = source.size();
+        current.sourceHash = hashBytes(source);
+
+        std::error_code error;
+        auto absolutePath = fs::absolute(path, error).string();
+        auto chunkName = "@" + path;
+        auto cachePath = directory / (std::to_string(hashBytes(absolutePath)) + ".luac");
+
+        std::string cached;
+        if (readFile(cachePath, cached) && cached.size() >= sizeof(BytecodeHeader)) {
+          BytecodeHeader header;
+          std::memcpy(&header, cached.data(), sizeof(header));
+          auto bytecode = std::string_view(cached).substr(sizeof(BytecodeHeader));
+          bool valid = std::memcmp(header.magic, current.magic, sizeof(header.magic)) == 0
+                       && header.sourceSize == current.sourceSize
+                       && header.sourceHash == current.sourceHash
+                       && header.bytecodeHash == hashBytes(bytecode);
+          if (valid && loadBytecode(state, bytecode, chunkName)) {
+            return;
+          }
+        }
+
+        // skip an optional shebang line as `luaL_loadfile` does, keeping line numbers intact
+        std::string_view code = source;
+        if (!code.empty() && code[0] == '#') {
+          auto lineEnd = code.find('\n');
+          code = lineEnd == std::string_view::npos ? std::string_view() : code.substr(lineEnd);
+        }
+
+        if (luaL_loadbufferx(state, code.data(), code.size(), chunkName.c_str(), nullptr)
+            != LUA_OK) {
+          const char *message = lua_tostring(state, -1);
+          std::string errorMessage = message ? message : "unknown lua error";
+          lua_pop(state, 1);
+          throw sol::error(errorMessage);
+        }
+
+        std::string bytecode;
+        lua_dump(
+            state,
+            [](lua_State *, const void *data, size_t size, void *target) {
+              static_cast<std::string *>(target)->append(static_cast<const char *>(data), size);
+              return 0;
+            },
+            &bytecode, 0);
+
+        current.bytecodeHash = hashBytes(bytecode);
+        fs::create_directories(directory, error);
+        writeFileAtomically(cachePath, current, bytecode);
+      }
+
     }  // namespace detail
   }    // namespace lua
 }  // namespace glue
 
+namespace {
+
+  struct FunctionData {
+    void *function;
+    lua::stack::Invoker invoke;
+    lua::stack::Deleter deleter;
+  };
+
+  int callFunction(lua_State *state) {
+    auto data = static_cast<FunctionData *>(lua_touserdata(state, lua_upvalueindex(1)));
+    lua::detail::stats::update(state, [](lua::BoundaryStats &stats) { stats.callsFromLua++; });
+    int results = -1;
+    // C++ exceptions are converted to lua errors outside of the catch block, so that no C++
+    // objects are alive when `lua_error` unwinds the stack
+    try {
+      lua::detail::MemoryLimitScope limit(state, false);
+      if (auto profiler = lua::detail::getRunningProfiler(state)) {
+        auto start = lua::detail::Profiler::Clock::now();
+        auto attributed = profiler->attributed;
+        results = data->invoke(data->function, state);
+        profiler->recordNative(state, data, start, attributed);
+      } else {
+        results = data->invoke(data->function, state);
+      }
+    } catch (const lua::detail::ErrorObject &error) {
+      error.push(state);
+    } catch (const std::exception &error) {
+      lua_pushstring(state, error.what());
+    } catch (...) {
+      lua_pushstring(state, "unknown C++ exception");
+    }
+    if (results < 0) {
+      return lua_error(state);
+    }
+    if (results >= lua::stack::yieldMarker) {
+      return lua_yield(state, results - lua::stack::yieldMarker);
+    }
+    return results;
+  }
+
+  int deleteFunction(lua_State *state) {
+    auto data = static_cast<FunctionData *>(lua_touserdata(state, 1));
+    data->deleter(data->function);
+    return 0;
+  }
+
+  [[noreturn]] void throwTypeError(lua_State *state, int index, const char *expected) {
+    throw std::runtime_error("bad argument #" + std::to_string(index) + " (" + expected
+                             + " expected, got " + luaL_typename(state, index) + ")");
+  }
+
+  [[noreturn]] void throwArgumentError(int index, const char *message) {
+    throw std::runtime_error("bad argument #" + std::to_string(index) + " (" + message + ")");
+  }
+
+}  // namespace
+
+bool lua::stack::getBoolean(lua_State *state, int index) {
+  if (lua_type(state, index) != LUA_TBOOLEAN) throwTypeError(state, index, "boolean");
+  return lua_toboolean(state, index);
+}
+
+int64_t lua::stack::getInteger(lua_State *state, int index) {
+  int isInteger = 0;
+  auto value = lua_type(state, index) == LUA_TNUMBER ? lua_tointegerx(state, index, &isInteger)
+                                                      : lua_Integer(0);
+  if (!isInteger) throwTypeError(state, index, "integer");
+  return value;
+}
+
+int64_t lua::stack::getInteger(lua_State *state, int index, int64_t min, int64_t max) {
+  auto value = getInteger(state, index);
+  if (value < min || value > max) throwArgumentError(index, "integer out of range");
+  return value;
+}
+
+double lua::stack::getNumber(lua_State *state, int index) {
+  if (lua_type(state, index) != LUA_TNUMBER) throwTypeError(state, index, "number");
+  return lua_tonumber(state, index);
+}
+
+std::string_view lua::stack::getString(lua_State *state, int index) {
+  if (lua_type(state, index) != LUA_TSTRING) throwTypeError(state, index, "string");
+  size_t size;
+  auto string = lua_tolstring(state, index, &size);
+  return std::string_view(string, size);
+}
+
+Any lua::stack::getAny(lua_State *state, int index) {
+  return lua::detail::stackToAny(state, index);
+}
+
+lua::StringRef lua::stack::getStringRef(lua_State *state, int index) {
+  if (lua_type(state, index) != LUA_TSTRING) throwTypeError(state, index, "string");
+  return lua::detail::makeStringRef(state, index);
+}
+
+lua::Results lua::stack::getResults(lua_State *state, int index) {
+  Results values;
+  for (int top = lua_gettop(state); index <= top; ++index) {
+    values.push_back(lua::detail::stackToAny(state, index));
+  }
+  return values;
+}
+
+void lua::stack::pushNil(lua_State *state) { lua_pushnil(state); }
+
+void lua::stack::pushBoolean(lua_State *state, bool value) { lua_pushboolean(state, value); }
+
+void lua::stack::pushInteger(lua_State *state, int64_t value) { lua_pushinteger(state, value); }
+
+void lua::stack::pushNumber(lua_State *state, double value) { lua_pushnumber(state, value); }
+
+void lua::stack::pushString(lua_State *state, const std::string_view &value) {
+  lua_pushlstring(state, value.data(), value.size());
+}
+
+void lua::stack::pushAny(lua_State *state, const Any &value) {
+  lua::detail::pushAny(state, value);
+}
+
+int lua::stack::pushResults(lua_State *state, const Results &values) {
+  if (!lua_checkstack(state, int(values.size()))) {
+    throw std::runtime_error("too many results");
+  }
+  for (size_t i = 0; i < values.size(); ++i) {
+    lua::detail::pushAny(state, values[i]);
+  }
+  return int(values.size());
+}
+
+Any lua::stack::pop(lua_State *state) {
+  auto value = lua::detail::stackToAny(state, -1);
+  lua_pop(state, 1);
+  return value;
+}
+
+void lua::stack::setGlobal(lua_State *state, const std::string &name) {
+  lua_setglobal(state, name.c_str());
+}
+
+void lua::stack::pushFunction(lua_State *state, void *function, Invoker invoke, Deleter deleter) {
+  auto data = static_cast<FunctionData *>(lua_newuserdatauv(state, sizeof(FunctionData), 0));
+  *data = FunctionData{function, invoke, deleter};
+  if (luaL_newmetatable(state, "LuaGlueFunction")) {
+    lua_pushcfunction(state, deleteFunction);
+    lua_setfield(state, -2, "__gc");
+  }
+  lua_setmetatable(state, -2);
+  lua_pushcclosure(state, callFunction, 1);
+}
+
+namespace {
+
+  const detail::LuaMap *getLuaMap(const Any &value) {
+    detail::LuaMapVisitor visitor;
+    if (value) value.accept(visitor);
+    return visitor.result;
+  }
+
+  /**
+   * Pushes the table and reads all elements using `read(index)`, which is called with the element
+   * on top of the stack and returns false if the element has an unexpected type.
+   */
+  template <class T, class Read>
+  void readSequence(const detail::LuaMap &table, std::vector<T> &target, const char *expected,
+                    Read read) {
+    auto state = table.data.lua_state();
+    table.data.push(state);
+    auto size = lua_rawlen(state, -1);
+    target.resize(size);
+    for (size_t i = 0; i < size; ++i) {
+      lua_rawgeti(state, -1, lua_Integer(i + 1));
+      bool valid = read(state, target[i]);
+      lua_pop(state, 1);
+      if (!valid) {
+        lua_pop(state, 1);
+        throw std::runtime_error("sequence element " + std::to_string(i + 1) + " is not a "
+                                 + expected);
+      }
+    }
+    lua_pop(state, 1);
+  }
+
+}  // namespace
+
+lua::Sequence::Sequence(const Value &v) : value(v), table(getLuaMap(value.data)) {
+  if (!table) {
+    throw std::runtime_error("value is not a lua table");
+  }
+}
+
+size_t lua::Sequence::size() const {
+  auto state = table->data.lua_state();
+  table->data.push(state);
+  auto size = lua_rawlen(state, -1);
+  lua_pop(state, 1);
+  return size;
+}
+
+Any lua::Sequence::get(size_t index) const {
+  auto state = table->data.lua_state();
+  table->data.push(state);
+  lua_rawgeti(state, -1, lua_Integer(index + 1));
+  auto result = detail::stackToAny(state, -1);
+  lua_pop(state, 2);
+  return result;
+}
+
+void lua::Sequence::set(size_t index, const Any &element) const {
+  auto state = table->data.lua_state();
+  table->data.push(state);
+  detail::pushAny(state, element);
+  lua_rawseti(state, -2, lua_Integer(index + 1));
+  lua_pop(state, 1);
+}
+
+void lua::Sequence::read(std::vector<double> &target) const {
+  readSequence(*table, target, "number", [](lua_State *state, double &result) {
+    int isNumber = 0;
+    result = lua_tonumberx(state, -1, &isNumber);
+    return isNumber != 0 && lua_type(state, -1) == LUA_TNUMBER;
+  });
+}
+
+void lua::Sequence::read(std::vector<int64_t> &target) const {
+  readSequence(*table, target, "integer", [](lua_State *state, int64_t &result) {
+    int isInteger = 0;
+    result = lua_tointegerx(state, -1, &isInteger);
+    return isInteger != 0 && lua_type(state, -1) == LUA_TNUMBER;
+  });
+}
+
+void lua::Sequence::read(std::vector<std::string> &target) const {
+  readSequence(*table, target, "string", [](lua_State *state, std::string &result) {
+    if (lua_type(state, -1) != LUA_TSTRING) return false;
+    size_t size;
+    auto string = lua_tolstring(state, -1, &size);
+    result.assign(string, size);
+    return true;
+  });
+}
+
 struct lua::Data {
+  // declared first, so that the allocator outlives the state
+  std::shared_ptr<PoolAllocator> allocator;
   std::unique_ptr<sol::state> owned;
   sol::state_view state;
   std::shared_ptr<detail::LuaMap> rootMap;
+  detail::ChunkCache chunks;
+  std::filesystem::path bytecodeCacheDirectory;
 
-  void init() { rootMap = std::make_shared<detail::LuaMap>(state.globals()); }
+  void init() {
+    detail::initLuaGlueData(state.lua_state());
+    rootMap = std::make_shared<detail::LuaMap>(state.globals());
+  }
 
   Data(lua_State *existing) : state(existing) { init(); }
-  Data() : owned(std::make_unique<sol::state>()), state(*owned) { init(); }
+  Data(std::shared_ptr<PoolAllocator> a)
+      : allocator(std::move(a)),
+        owned(allocator ? std::make_unique<sol::state>(sol::default_at_panic,
+                                                       &PoolAllocator::luaAllocate, allocator.get())
+                        : std::make_unique<sol::state>()),
+        state(*owned) {
+    // the limit is enforced by protected calls into lua
+    if (allocator) allocator->enforceLimit(false);
+    init();
+  }
   ~Data() {
-    if (owned) detail::getLuaGlueData(*owned).onDestroy.emit();
+    if (owned) detail::getLuaGlueData(owned->lua_state()).releaseHandles();
   }
 };
 
-lua::State::State() : data(std::make_shared<Data>()) {
-  using Instance = detail::LuaGlueInstance;
+lua::State::State() : State(std::shared_ptr<PoolAllocator>()) {}
 
+lua::State::State(std::shared_ptr<PoolAllocator> allocator)
+    : data(std::make_shared<Data>(std::move(allocator))) {
   // clang-format off
   data->state.new_usertype<Any>("Any", 
     sol::meta_function::to_string, +[](const Any &value) {
@@ -321,81 +2478,551 @@ lua::State::State() : data(std::make_shared<Data>()) {
       return stream.str();
     }
   );
+  // clang-format on
 
-  auto forwardBinaryMetaMethodWithDefault = [](auto  glueName, auto defaultOp){
-    return [glueName, defaultOp](sol::this_state state, const Instance &value, const Instance &other) -> sol::object {
-      auto metamethod = value.classTable[glueName];
-      if (metamethod.valid()) {
-        return metamethod(detail::anyToSol(state, value), detail::anyToSol(state, other));
-      } else {
-        return sol::make_object(state, defaultOp(value, other));
-      }
-    };
-  };
+  stack::registerBufferMetatable(data->state.lua_state());
+}
 
-  auto forwardBinaryMetaMethod = [](auto  glueName){
-    return [glueName](sol::object value, sol::object other) -> sol::object {
-      auto &instance = value.as<Instance &>();
-      auto metamethod = instance.classTable[glueName];
-      if (metamethod.valid()) {
-        return metamethod(value, other);
-      } else {
-        throw std::runtime_error("used unsupported binary operator");
-      }
-    };
-  };
+lua::State::State(lua_State *existing) : data(std::make_shared<Data>(existing)) {}
 
-  data->state.new_usertype<Instance>("LuaGlueInstance",
-    sol::base_classes, sol::bases<Any>(),
-    sol::meta_function::index, +[](const Instance &value, sol::object key) -> sol::object { 
-      return value.classTable[key];
-    },
-    sol::meta_function::equal_to, forwardBinaryMetaMethodWithDefault(keys::operators::eq, [](auto && a, auto && b){ return &a == &b; }),
-    sol::meta_function::unary_minus, forwardBinaryMetaMethod(keys::operators::unm),
-    sol::meta_function::addition, forwardBinaryMetaMethod(keys::operators::add),
-    sol::meta_function::subtraction, forwardBinaryMetaMethod(keys::operators::sub),
-    sol::meta_function::multiplication, forwardBinaryMetaMethod(keys::operators::mul),
-    sol::meta_function::division, forwardBinaryMetaMethod(keys::operators::div),
-    sol::meta_function::power_of, forwardBinaryMetaMethod(keys::operators::pow),
-    sol::meta_function::less_than, forwardBinaryMetaMethod(keys::operators::lt),
-    sol::meta_function::less_than_or_equal_to, forwardBinaryMetaMethod(keys::operators::le),
-    sol::meta_function::floor_division, forwardBinaryMetaMethod(keys::operators::idiv),
-    sol::meta_function::modulus, forwardBinaryMetaMethod(keys::operators::mod),
-    sol::meta_function::to_string, +[](sol::this_state state,const Instance &value) -> sol::object {
-      auto toString = value.classTable[keys::operators::tostring];
-      if (toString.valid()) {
-        return value.classTable[keys::operators::tostring](detail::anyToSol(state, value));
-      } else {
-        std::stringstream stream;
-        stream << value.type().name << '(' << &value << ')';
-        return sol::make_object(state, stream.str());
-      }
+glue::MapValue lua::State::root() const { return MapValue(data->rootMap); }
+
+namespace {
+
+  size_t heapSize(lua_State *state) {
+    return size_t(lua_gc(state, LUA_GCCOUNT)) * 1024 + size_t(lua_gc(state, LUA_GCCOUNTB));
+  }
+
+  /**
+   * Runs `collect` and records its duration and the heap size before and after it.
+   */
+  template <class F> auto measureCollection(lua_State *state, F &&collect) {
+    auto &stats = lua::detail::getLuaGlueData(state).gcStats;
+    stats.heapBefore = heapSize(state);
+    auto start = std::chrono::steady_clock::now();
+    auto result = collect();
+    auto pause = std::chrono::steady_clock::now() - start;
+    stats.heapAfter = heapSize(state);
+    stats.lastPause = pause;
+    stats.maxPause = std::max<std::chrono::nanoseconds>(stats.maxPause, pause);
+    stats.totalPause += pause;
+    return result;
+  }
+
+  /**
+   * Calls the base library's `collectgarbage` and remembers the collector mode selected by the
+   * script, as lua only reports the mode when switching it.
+   */
+  int collectGarbageTrackingMode(lua_State *state) {
+    auto option = luaL_optstring(state, 1, "collect");
+    int mode = std::strcmp(option, "generational") == 0  ? LUA_GCGEN
+               : std::strcmp(option, "incremental") == 0 ? LUA_GCINC
+                                                          : 0;
+    lua_pushvalue(state, lua_upvalueindex(1));
+    lua_insert(state, 1);
+    lua_call(state, lua_gettop(state) - 1, LUA_MULTRET);
+    if (mode) lua::detail::getLuaGlueData(state).gcMode = mode;
+    return lua_gettop(state);
+  }
+
+  /**
+   * Wraps the global `collectgarbage` unless it is already wrapped.
+   */
+  void trackScriptGCMode(lua_State *state) {
+    lua_getglobal(state, "collectgarbage");
+    if (lua_type(state, -1) != LUA_TFUNCTION
+        || lua_tocfunction(state, -1) == collectGarbageTrackingMode) {
+      lua_pop(state, 1);
+      return;
     }
-  );
-  // clang-format on
+    lua_pushcclosure(state, collectGarbageTrackingMode, 1);
+    lua_setglobal(state, "collectgarbage");
+  }
+
+  bool isGenerationalGC(lua_State *state) {
+    return lua::detail::getLuaGlueData(state).gcMode == LUA_GCGEN;
+  }
+
+}  // namespace
+
+void lua::State::openStandardLibs() const {
+  data->state.open_libraries();
+  trackScriptGCMode(data->state.lua_state());
 }
 
-lua::State::State(lua_State *existing) : data(std::make_shared<Data>(existing)) {}
+void lua::State::collectGarbage() const {
+  auto state = data->state.lua_state();
+  measureCollection(state, [&]() { return lua_gc(state, LUA_GCCOLLECT); });
+  detail::getLuaGlueData(state).gcStats.fullCollections++;
+}
 
-glue::MapValue lua::State::root() const { return MapValue(data->rootMap); }
+void lua::State::setIncrementalGC(const IncrementalGC &parameters) const {
+  auto state = data->state.lua_state();
+  lua_gc(state, LUA_GCINC, parameters.pause, parameters.stepMultiplier, parameters.stepSize);
+  detail::getLuaGlueData(state).gcMode = LUA_GCINC;
+}
 
-void lua::State::openStandardLibs() const { data->state.open_libraries(); }
+void lua::State::setGenerationalGC(const GenerationalGC &parameters) const {
+  auto state = data->state.lua_state();
+  lua_gc(state, LUA_GCGEN, parameters.minorMultiplier, parameters.majorMultiplier);
+  detail::getLuaGlueData(state).gcMode = LUA_GCGEN;
+}
 
-void lua::State::collectGarbage() const { data->state.collect_garbage(); }
+void lua::State::setGCRunning(bool running) const {
+  lua_gc(data->state.lua_state(), running ? LUA_GCRESTART : LUA_GCSTOP);
+}
+
+bool lua::State::isGCRunning() const { return lua_gc(data->state.lua_state(), LUA_GCISRUNNING); }
+
+bool lua::State::collectGarbageStep(std::chrono::nanoseconds budget) const {
+  auto state = data->state.lua_state();
+  auto &glueData = detail::getLuaGlueData(state);
+  auto generational = isGenerationalGC(state);
+  auto deadline = std::chrono::steady_clock::now() + budget;
+  bool finished = measureCollection(state, [&]() {
+    // each step of the generational collector is a complete minor collection, for which lua
+    // never reports a finished cycle
+    if (generational) {
+      glueData.gcStats.steps++;
+      lua_gc(state, LUA_GCSTEP, 0);
+      return true;
+    }
+    do {
+      glueData.gcStats.steps++;
+      if (lua_gc(state, LUA_GCSTEP, 0)) return true;
+    } while (std::chrono::steady_clock::now() < deadline);
+    return false;
+  });
+  if (finished) glueData.gcStats.completedCycles++;
+  return finished;
+}
+
+bool lua::State::collectGarbageStep(size_t kilobytes) const {
+  auto state = data->state.lua_state();
+  auto &glueData = detail::getLuaGlueData(state);
+  auto generational = isGenerationalGC(state);
+  bool finished = measureCollection(state, [&]() {
+    return lua_gc(state, LUA_GCSTEP, int(std::min<size_t>(kilobytes, INT_MAX))) != 0
+           || generational;
+  });
+  glueData.gcStats.steps++;
+  if (finished) glueData.gcStats.completedCycles++;
+  return finished;
+}
+
+lua::GCStats lua::State::gcStats() const {
+  return detail::getLuaGlueData(data->state.lua_state()).gcStats;
+}
 
 Value lua::State::run(const std::string_view &code, const std::string &name) const {
-  return detail::solToAny(data->state.script(code, name));
+  auto state = data->state.lua_state();
+  data->chunks.load(state, code, name).push(state);
+  detail::hooks::Scope budget(state, detail::getLuaGlueData(state).budget);
+  return budget.run([&]() { return detail::solToAny(detail::protectedCall(state, 0)); });
+}
+
+Value lua::State::get(const std::string &value) const {
+  static const std::string name = "anonymous lua code";
+  auto state = data->state.lua_state();
+  data->chunks.load(state, "return ", value, name).push(state);
+  detail::hooks::Scope budget(state, detail::getLuaGlueData(state).budget);
+  return budget.run([&]() { return detail::solToAny(detail::protectedCall(state, 0)); });
+}
+
+Value lua::State::run(const Chunk &chunk) const {
+  detail::LuaFunctionVisitor visitor;
+  if (!chunk.function.data || !chunk.function.data.accept(visitor)) {
+    throw std::runtime_error("invalid lua chunk");
+  }
+  auto state = data->state.lua_state();
+  if (chunk.owner != state) {
+    throw std::invalid_argument("lua chunk was compiled by a different state");
+  }
+  visitor.result->data.push(state);
+  detail::hooks::Scope budget(state, detail::getLuaGlueData(state).budget);
+  return budget.run([&]() { return detail::solToAny(detail::protectedCall(state, 0)); });
+}
+
+lua::Results lua::State::call(const Value &function, const AnyArguments &args) const {
+  detail::LuaFunctionVisitor visitor;
+  if (function.data && function.data.accept(visitor)) {
+    auto state = data->state.lua_state();
+    detail::hooks::Scope budget(state, detail::getLuaGlueData(state).budget);
+    return budget.run([&]() { return visitor.result->call(args); });
+  }
+  auto result = function.data.get<AnyFunction>().call(args);
+  detail::ResultsVisitor resultsVisitor;
+  if (result && result.accept(resultsVisitor)) {
+    return *resultsVisitor.result;
+  }
+  return Results{result};
+}
+
+lua::Expected<Value> lua::State::tryRun(const std::string_view &code,
+                                        const std::string &name) const {
+  auto state = data->state.lua_state();
+  auto &glueData = detail::getLuaGlueData(state);
+  try {
+    data->chunks.load(state, code, name).push(state);
+  } catch (const std::exception &error) {
+    return detail::errors::fromException(glueData.lastError, error);
+  }
+  detail::hooks::Scope budget(state, glueData.budget);
+  ScriptError error;
+  if (!detail::errors::call(state, 0, 1, error)) {
+    error.budgetExceeded = budget.exhausted();
+    return error;
+  }
+  Any result;
+  try {
+    result = detail::stackToAny(state, -1);
+  } catch (const std::exception &exception) {
+    lua_pop(state, 1);
+    return detail::errors::fromException(glueData.lastError, exception);
+  }
+  lua_pop(state, 1);
+  return Value(std::move(result));
 }
 
+lua::Expected<lua::Results> lua::State::tryCall(const Value &function,
+                                                const AnyArguments &args) const {
+  auto state = data->state.lua_state();
+  auto &glueData = detail::getLuaGlueData(state);
+  detail::LuaFunctionVisitor visitor;
+  if (!function.data || !function.data.accept(visitor)) {
+    try {
+      return call(function, args);
+    } catch (const std::exception &error) {
+      return detail::errors::fromException(glueData.lastError, error);
+    }
+  }
+
+  auto base = lua_gettop(state);
+  try {
+    detail::reserveArguments(state, args.size());
+    visitor.result->data.push(state);
+    for (auto &arg : args) {
+      detail::pushAny(state, arg);
+    }
+  } catch (const std::exception &error) {
+    lua_settop(state, base);
+    return detail::errors::fromException(glueData.lastError, error);
+  }
+  detail::stats::update(state, [](BoundaryStats &stats) { stats.callsIntoLua++; });
+  detail::hooks::Scope budget(state, glueData.budget);
+  ScriptError error;
+  if (!detail::errors::call(state, int(args.size()), LUA_MULTRET, error)) {
+    error.budgetExceeded = budget.exhausted();
+    return error;
+  }
+  Results results;
+  try {
+    for (int index = base + 1, top = lua_gettop(state); index <= top; ++index) {
+      results.push_back(detail::stackToAny(state, index));
+    }
+  } catch (const std::exception &exception) {
+    lua_settop(state, base);
+    return detail::errors::fromException(glueData.lastError, exception);
+  }
+  lua_settop(state, base);
+  return results;
+}
+
+void lua::State::setErrorTracebacks(bool enabled) const {
+  detail::getLuaGlueData(data->state.lua_state()).lastError.tracebacks = enabled;
+}
+
+void lua::State::callBatch(const Value &function, const Batch &batch,
+                           const Buffer &results) const {
+  detail::LuaFunctionVisitor visitor;
+  if (!function.data || !function.data.accept(visitor)) {
+    throw std::invalid_argument("batch calls require a lua function");
+  }
+  if (results.size() != batch.size()) {
+    throw std::invalid_argument("batch results need one element per row");
+  }
+  if (results.isReadOnly()) {
+    throw std::invalid_argument("batch results must be writable");
+  }
+
+  auto state = data->state.lua_state();
+  auto &columns = batch.columns();
+  auto arguments = int(columns.size());
+  if (!lua_checkstack(state, arguments + 2)) {
+    throw std::runtime_error("too many batch arguments");
+  }
+
+  detail::hooks::Scope budget(state, detail::getLuaGlueData(state).budget);
+  budget.run([&]() {
+    auto base = lua_gettop(state);
+    visitor.result->data.push(state);
+    for (size_t row = 0; row < batch.size(); ++row) {
+      lua_pushvalue(state, base + 1);
+      for (auto &column : columns) {
+        stack::pushBufferElement(state, column, row);
+      }
+      detail::stats::update(state, [](BoundaryStats &stats) { stats.callsIntoLua++; });
+      try {
+        detail::callProtected(state, arguments, 1);
+      } catch (...) {
+        lua_settop(state, base);
+        throw;
+      }
+      if (!stack::toBufferElement(state, -1, results, row)) {
+        // numbers only fail to convert if integer buffers receive floats or values out of range
+        int isInteger = 0;
+        lua_tointegerx(state, -1, &isInteger);
+        std::string reason;
+        if (lua_type(state, -1) != LUA_TNUMBER) {
+          reason = std::string(luaL_typename(state, -1)) + " instead of a number";
+        } else if (!isInteger) {
+          reason = std::string("non-integer number for ") + Buffer::typeName(results.type())
+                   + " buffer";
+        } else {
+          reason = std::string("number out of range for ") + Buffer::typeName(results.type())
+                   + " buffer";
+        }
+        lua_settop(state, base);
+        throw std::runtime_error("batch call " + std::to_string(row) + " returned " + reason);
+      }
+      lua_pop(state, 1);
+    }
+    lua_settop(state, base);
+  });
+}
+
+std::vector<double> lua::State::callBatch(const Value &function, const Batch &batch) const {
+  std::vector<double> results(batch.size());
+  callBatch(function, batch, Buffer(results.data(), results.size()));
+  return results;
+}
+
+lua::Coroutine lua::State::createCoroutine(const Value &function) const {
+  auto state = data->state.lua_state();
+  auto coroutine = std::make_shared<detail::CoroutineData>();
+  coroutine->thread = lua_newthread(state);
+  coroutine->reference = sol::main_reference(state, -1);
+  coroutine->handle.attach(state);
+  lua_pop(state, 1);
+  detail::pushAny(coroutine->thread, function.data);
+  if (lua_type(coroutine->thread, -1) != LUA_TFUNCTION) {
+    throw std::runtime_error("coroutines must be created from functions");
+  }
+  return Coroutine(std::move(coroutine));
+}
+
+lua::Coroutine lua::State::createCoroutine(const Chunk &chunk) const {
+  if (!chunk.function.data) {
+    throw std::runtime_error("invalid lua chunk");
+  }
+  if (chunk.owner != data->state.lua_state()) {
+    throw std::invalid_argument("lua chunk was compiled by a different state");
+  }
+  return createCoroutine(chunk.function);
+}
+
+lua::Results lua::Coroutine::resume(const AnyArguments &args) const {
+  if (!data || data->status != Status::Suspended) {
+    throw std::runtime_error("cannot resume a coroutine that is not suspended");
+  }
+  if (!data->handle.getOwner()) {
+    throw std::runtime_error("cannot resume a coroutine of a destroyed lua state");
+  }
+
+  auto thread = data->thread;
+  detail::reserveArguments(thread, args.size());
+  auto base = lua_gettop(thread);
+  try {
+    for (auto &arg : args) {
+      detail::pushAny(thread, arg);
+    }
+  } catch (...) {
+    lua_settop(thread, base);
+    throw;
+  }
+  data->status = Status::Running;
+  int count = 0;
+  int result;
+  {
+    auto &budget = data->budget ? *data->budget : detail::getLuaGlueData(thread).budget;
+    detail::hooks::Scope scope(thread, budget);
+    detail::stats::DepthScope depth(thread);
+    detail::MemoryLimitScope limit(thread, true);
+    result = lua_resume(thread, nullptr, int(args.size()), &count);
+    data->preempted = result == LUA_YIELD && scope.exhausted();
+  }
+
+  Results results;
+  if (result == LUA_OK || result == LUA_YIELD) {
+    data->status = result == LUA_OK ? Status::Done : Status::Suspended;
+    for (int index = lua_gettop(thread) - count + 1, top = lua_gettop(thread); index <= top;
+         ++index) {
+      results.push_back(detail::stackToAny(thread, index));
+    }
+    lua_pop(thread, count);
+  } else {
+    data->status = Status::Error;
+    const char *message = lua_tostring(thread, -1);
+    data->error = message ? message : "unknown lua error";
+    lua_settop(thread, 0);
+  }
+  return results;
+}
+
+void lua::Coroutine::setBudget(const Budget &budget) const {
+  if (data) data->budget = budget;
+}
+
+bool lua::Coroutine::wasPreempted() const { return data && data->preempted; }
+
+lua::Coroutine::Status lua::Coroutine::status() const {
+  return data ? data->status : Status::Done;
+}
+
+const std::string &lua::Coroutine::error() const {
+  static const std::string none;
+  return data ? data->error : none;
+}
+
+lua::Chunk lua::State::compile(const std::string_view &code, const std::string &name) const {
+  auto state = data->state.lua_state();
+  sol::object function = data->chunks.load(state, code, name);
+  return Chunk(detail::solToAny(std::move(function)), state);
+}
+
+void lua::State::setChunkCacheCapacity(size_t capacity) const {
+  data->chunks.setCapacity(capacity);
+}
+
+void lua::State::clearChunkCache() const { data->chunks.clear(); }
+
+lua::ChunkCacheStats lua::State::chunkCacheStats() const { return data->chunks.stats; }
+
 Value lua::State::runFile(const std::string &path) const {
-  return detail::solToAny(data->state.script_file(path));
+  auto state = data->state.lua_state();
+  if (data->bytecodeCacheDirectory.empty()) {
+    if (luaL_loadfilex(state, path.c_str(), nullptr) != LUA_OK) {
+      const char *message = lua_tostring(state, -1);
+      std::string error = message ? message : "unknown lua error";
+      lua_pop(state, 1);
+      throw sol::error(error);
+    }
+  } else {
+    detail::loadCachedFile(state, path, data->bytecodeCacheDirectory);
+  }
+  detail::hooks::Scope budget(state, detail::getLuaGlueData(state).budget);
+  return budget.run([&]() { return detail::solToAny(detail::protectedCall(state, 0)); });
+}
+
+void lua::State::setBudget(const Budget &budget) const {
+  detail::getLuaGlueData(data->state.lua_state()).budget = budget;
+}
+
+lua::BoundaryStats lua::State::stats() const {
+  return detail::getLuaGlueData(data->state.lua_state()).stats;
+}
+
+void lua::State::resetStats() const {
+  detail::getLuaGlueData(data->state.lua_state()).stats = BoundaryStats();
+}
+
+void lua::State::startProfiler(const ProfilerOptions &options) const {
+  auto state = data->state.lua_state();
+  auto &glueData = detail::getLuaGlueData(state);
+  if (!glueData.profiler) {
+    glueData.profiler = std::make_unique<detail::Profiler>();
+  }
+  auto &profiler = *glueData.profiler;
+  if (!profiler.running) {
+    detail::runningProfilers++;
+    profiler.foreignHook = detail::hooks::foreignHook(glueData, detail::HookState::get(state));
+  }
+  profiler.options = options;
+  profiler.profile = Profile();
+  profiler.pendingNative.clear();
+  profiler.nativeNames.clear();
+  profiler.running = true;
+  profiler.executed = 0;
+  profiler.mark();
+  detail::hooks::update(state, glueData, profiler.foreignHook);
+}
+
+void lua::State::stopProfiler() const {
+  auto state = data->state.lua_state();
+  auto &glueData = detail::getLuaGlueData(state);
+  if (!glueData.profiler || !glueData.profiler->running) return;
+  auto &profiler = *glueData.profiler;
+  profiler.running = false;
+  profiler.flushNative(std::string());
+  detail::runningProfilers--;
+  detail::hooks::update(state, glueData, profiler.foreignHook);
+}
+
+bool lua::State::isProfiling() const {
+  auto &profiler = detail::getLuaGlueData(data->state.lua_state()).profiler;
+  return profiler && profiler->running;
+}
+
+lua::Profile lua::State::profile() const {
+  auto &profiler = detail::getLuaGlueData(data->state.lua_state()).profiler;
+  return profiler ? profiler->profile : Profile();
+}
+
+void lua::State::setBytecodeCacheDirectory(const std::string &path) const {
+  data->bytecodeCacheDirectory = path;
+}
+
+lua::MemoryStats lua::State::memoryStats() const {
+  if (data->allocator) {
+    return data->allocator->stats();
+  }
+  MemoryStats stats;
+  stats.liveBytes = size_t(lua_gc(data->state.lua_state(), LUA_GCCOUNT, 0)) * 1024
+                    + size_t(lua_gc(data->state.lua_state(), LUA_GCCOUNTB, 0));
+  return stats;
+}
+
+void lua::State::addInlineType(const InlineType &type) const {
+  auto &inlineTypes = detail::getLuaGlueData(data->state.lua_state()).inlineTypes;
+  inlineTypes.push_back(std::make_unique<InlineType>(type));
+}
+
+void lua::State::setMapIdentityCache(bool enabled) const {
+  detail::getLuaGlueData(data->state.lua_state()).cacheMaps = enabled;
+}
+
+void lua::State::invalidateMap(const MapValue &map) const {
+  detail::MapVisitor visitor;
+  if (map.data && map.data.accept(visitor)) {
+    detail::identity::remove(data->state.lua_state(), visitor.result);
+  }
 }
 
 lua_State *lua::State::getRawLuaState() const { return data->state.lua_state(); }
 
 lua::State::~State() {}
 
-void lua::State::addModule(const MapValue &map, const MapValue &r) {
+void lua::State::addModule(const MapValue &map, const MapValue &r, ModuleLoading loading) {
+  if (loading == ModuleLoading::Lazy) {
+    auto state = data->state.lua_state();
+    // classes are converted when accessed or once an instance of an unknown class is converted
+    detail::getLuaGlueData(state).pendingModules.push_back(map);
+
+    // lua targets become proxies of the module, so that only accessed entries are converted
+    if (auto target = getLuaMap(r.data)) {
+      target->data.push(state);
+      bool extended = detail::lazy::extend(state, lua_gettop(state), map.data);
+      lua_pop(state, 1);
+      if (extended) return;
+    }
+
+    map.forEach([&](auto &&key, auto &&value) {
+      r[key] = detail::solToAny(detail::anyToSol(state, Value(value).data, nullptr, true));
+      return false;
+    });
+    return;
+  }
+
   // use cache to not create copies of referenced tables
   detail::MapCache cache;
 
@@ -419,5 +3046,11 @@ void lua::State::addModule(const MapValue &map, const MapValue &r) {
 }
 
 Value lua::State::getValueDeleter() const {
-  return detail::solToAny(sol::make_object(data->state, [](Any &value) { value.reset(); }));
+  return detail::solToAny(sol::make_object(data->state, [](sol::object value) {
+    if (auto instance = detail::instances::get(value)) {
+      instance->reset();
+    } else if (value.is<Any>()) {
+      value.as<Any &>().reset();
+    }
+  }));
 }
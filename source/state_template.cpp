@@ -0,0 +1,88 @@
+#include <glue/lua/state_template.h>
+
+#include <lua.hpp>
+#include <stdexcept>
+
+using namespace glue;
+
+namespace {
+
+  std::string popError(lua_State *state) {
+    const char *message = lua_tostring(state, -1);
+    std::string error = message ? message : "unknown lua error";
+    lua_pop(state, 1);
+    return error;
+  }
+
+  std::string compile(const std::string_view &code, const std::string &name) {
+    // bytecode does not depend on the state, so a bare state is enough for compiling
+    std::unique_ptr<lua_State, decltype(&lua_close)> state(luaL_newstate(), &lua_close);
+    if (!state) {
+      throw std::bad_alloc();
+    }
+    if (luaL_loadbufferx(state.get(), code.data(), code.size(), name.c_str(), "t") != LUA_OK) {
+      throw std::runtime_error(popError(state.get()));
+    }
+    std::string bytecode;
+    lua_dump(
+        state.get(),
+        [](lua_State *, const void *data, size_t size, void *target) {
+          static_cast<std::string *>(target)->append(static_cast<const char *>(data), size);
+          return 0;
+        },
+        &bytecode, 0);
+    return bytecode;
+  }
+
+}  // namespace
+
+lua::StateTemplate &lua::StateTemplate::openStandardLibs() {
+  Step step;
+  step.standardLibs = true;
+  steps.push_back(std::move(step));
+  return *this;
+}
+
+lua::StateTemplate &lua::StateTemplate::addModule(const MapValue &map, ModuleLoading loading) {
+  Step step;
+  step.module = map;
+  step.loading = loading;
+  steps.push_back(std::move(step));
+  return *this;
+}
+
+lua::StateTemplate &lua::StateTemplate::run(const std::string_view &code,
+                                            const std::string &name) {
+  Step step;
+  step.bytecode = compile(code, name);
+  step.name = name;
+  steps.push_back(std::move(step));
+  return *this;
+}
+
+void lua::StateTemplate::initialize(State &state) const {
+  auto luaState = state.getRawLuaState();
+  for (auto &step : steps) {
+    if (step.standardLibs) {
+      state.openStandardLibs();
+    } else if (step.module) {
+      state.addModule(step.module, step.loading);
+    } else {
+      if (luaL_loadbufferx(luaState, step.bytecode.data(), step.bytecode.size(),
+                           step.name.c_str(), "b")
+          != LUA_OK) {
+        throw std::runtime_error(popError(luaState));
+      }
+      // called like any other function, so that budgets, memory limits and errors apply
+      state.call(Value(stack::pop(luaState)));
+    }
+  }
+}
+
+std::unique_ptr<lua::State> lua::StateTemplate::create(
+    std::shared_ptr<PoolAllocator> allocator) const {
+  auto state = allocator ? std::make_unique<State>(std::move(allocator))
+                         : std::make_unique<State>();
+  initialize(*state);
+  return state;
+}
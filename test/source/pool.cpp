@@ -0,0 +1,70 @@
+#include <doctest/doctest.h>
+#include <glue/lua/pool.h>
+
+#include <stdexcept>
+#include <vector>
+
+TEST_CASE("State pool") {
+  glue::lua::StatePool pool(
+      [](glue::lua::State &state) {
+        state.openStandardLibs();
+        state.root()["offset"] = 10;
+        state.run("function compute(x) return x * 2 + offset end");
+      },
+      4);
+  CHECK(pool.size() == 4);
+
+  SUBCASE("results") {
+    std::vector<std::future<int>> results;
+    for (int i = 0; i < 100; ++i) {
+      results.push_back(pool.submit([i](glue::lua::State &state) {
+        return state.call(state.get("compute"), i).get<int>(0);
+      }));
+    }
+    for (int i = 0; i < 100; ++i) {
+      CHECK(results[i].get() == i * 2 + 10);
+    }
+  }
+
+  SUBCASE("errors") {
+    auto result = pool.submit([](glue::lua::State &state) { state.run("error('x')"); });
+    CHECK_THROWS_AS(result.get(), std::runtime_error);
+  }
+
+  SUBCASE("nested jobs") {
+    auto result = pool.submit([&](glue::lua::State &) {
+      return pool.submit([](glue::lua::State &state) { return state.get<int>("offset"); });
+    });
+    CHECK(result.get().get() == 10);
+  }
+
+  SUBCASE("shared data") {
+    glue::lua::SharedData::Array values;
+    for (int i = 0; i < 100; ++i) values.push_back(i);
+    glue::lua::SharedData data(glue::lua::SharedData::Table{{"values", values}});
+    std::vector<std::future<int>> results;
+    for (int i = 0; i < 100; ++i) {
+      results.push_back(pool.submit([data, i](glue::lua::State &state) {
+        state.root()["data"] = data;
+        return state.call(state.get("function(i) return data.values[i + 1] end"), i).get<int>(0);
+      }));
+    }
+    for (int i = 0; i < 100; ++i) {
+      CHECK(results[i].get() == i);
+    }
+  }
+
+  SUBCASE("batches") {
+    std::vector<int64_t> inputs(1001), outputs(1001);
+    for (size_t i = 0; i < inputs.size(); ++i) inputs[i] = int64_t(i);
+    glue::lua::Batch batch(inputs.size());
+    batch.addColumn(glue::lua::Buffer(inputs.data(), inputs.size()));
+    pool.callBatch("compute", batch, glue::lua::Buffer(outputs.data(), outputs.size()));
+    for (size_t i = 0; i < outputs.size(); ++i) {
+      CHECK(outputs[i] == int64_t(i) * 2 + 10);
+    }
+    CHECK_THROWS_AS(pool.callBatch("function(x) return nil end", batch,
+                                   glue::lua::Buffer(outputs.data(), outputs.size())),
+                    std::runtime_error);
+  }
+}
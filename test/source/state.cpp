@@ -2,9 +2,15 @@
 #include <glue/class.h>
 #include <glue/enum.h>
 #include <glue/lua/state.h>
+#include <glue/lua/state_template.h>
 
+#include <chrono>
 #include <exception>
+#include <filesystem>
+#include <fstream>
+#include <limits>
 #include <string>
+#include <vector>
 
 TEST_CASE("Run script and get result") {
   glue::lua::State state;
@@ -34,6 +40,68 @@ TEST_CASE("Run script and get result") {
   }
 }
 
+TEST_CASE("Chunk cache") {
+  glue::lua::State state;
+  state.openStandardLibs();
+  state.setChunkCacheCapacity(2);
+
+  CHECK(state.get<int>("1+1") == 2);
+  CHECK(state.get<int>("1+1") == 2);
+  CHECK(state.chunkCacheStats().hits == 1);
+  CHECK(state.chunkCacheStats().misses == 1);
+
+  SUBCASE("expressions share entries with the code they run") {
+    CHECK(state.run("return 1+1")->get<int>() == 2);
+    CHECK(state.chunkCacheStats().hits == 2);
+    CHECK(state.chunkCacheStats().size == 1);
+  }
+
+  SUBCASE("chunk names are part of the key") {
+    CHECK_NOTHROW(state.run("return 1", "a"));
+    CHECK_NOTHROW(state.run("return 1", "b"));
+    CHECK(state.chunkCacheStats().misses == 3);
+  }
+
+  SUBCASE("least recently used chunks are evicted") {
+    CHECK(state.get<int>("2") == 2);
+    CHECK(state.get<int>("1+1") == 2);
+    CHECK(state.get<int>("3") == 3);
+    CHECK(state.chunkCacheStats().evictions == 1);
+    CHECK(state.chunkCacheStats().size == 2);
+    CHECK(state.get<int>("1+1") == 2);
+    CHECK(state.chunkCacheStats().hits == 3);
+  }
+
+  SUBCASE("errors are not cached") {
+    CHECK_THROWS_AS(state.run("f(syntax error]"), std::runtime_error);
+    CHECK_THROWS_AS(state.run("f(syntax error]"), std::runtime_error);
+    CHECK(state.chunkCacheStats().misses == 3);
+  }
+
+  SUBCASE("disabled cache") {
+    state.setChunkCacheCapacity(0);
+    CHECK(state.chunkCacheStats().size == 0);
+    CHECK(state.get<int>("1+1") == 2);
+    CHECK(state.chunkCacheStats().misses == 2);
+  }
+
+  SUBCASE("compiled chunks") {
+    state.run("x = 0");
+    auto chunk = state.compile("x = x + 1; return x");
+    CHECK(state.run(chunk)->get<int>() == 1);
+    CHECK(state.run(chunk)->get<int>() == 2);
+    CHECK_THROWS_AS(state.run(glue::lua::Chunk()), std::runtime_error);
+  }
+
+  SUBCASE("chunks of other states") {
+    glue::lua::State other;
+    auto chunk = other.compile("return 1");
+    CHECK_THROWS_AS(state.run(chunk), std::invalid_argument);
+    CHECK_THROWS_AS(state.createCoroutine(chunk), std::invalid_argument);
+    CHECK(other.run(chunk)->get<int>() == 1);
+  }
+}
+
 TEST_CASE("Mapped Values") {
   glue::lua::State state;
   glue::MapValue root = state.root();
@@ -118,6 +186,14 @@ TEST_CASE("Mapped Values") {
     CHECK(root["tostring"].asFunction()(42).get<std::string>() == "42");
   }
 
+  SUBCASE("errors raised by __index") {
+    state.openStandardLibs();
+    state.run("setmetatable(_G, {__index = function(_, key) error('no ' .. key) end})");
+    CHECK_THROWS_AS(root["missing"]->get<int>(), std::runtime_error);
+    CHECK_NOTHROW(root["x"] = 1);
+    CHECK(root["x"]->get<int>() == 1);
+  }
+
   SUBCASE("maps") {
     auto map = glue::createAnyMap();
     map["a"] = 44;
@@ -130,6 +206,283 @@ TEST_CASE("Mapped Values") {
   }
 }
 
+TEST_CASE("Typed functions") {
+  glue::lua::State state;
+  state.openStandardLibs();
+
+  state.bind("add", [](double a, double b) { return a + b; });
+  state.bind("greet", [](const std::string &name) { return "Hello " + name + "!"; });
+  state.bind("length", [](std::string_view value) { return value.size(); });
+  state.bind("isTrue", [](bool value) { return value; });
+  state.bind("echo", [](glue::Any value) { return value; });
+
+  int calls = 0;
+  state.bind("count", [&]() { calls++; });
+
+  CHECK(state.get<double>("add(1.5, 2)") == 3.5);
+  CHECK(state.get<std::string>("greet('Lua')") == "Hello Lua!");
+  CHECK(state.get<int>("length('four')") == 4);
+  CHECK(state.get<bool>("isTrue(true)") == true);
+  CHECK(state.get<int>("echo(42)") == 42);
+  CHECK_NOTHROW(state.run("count(); count()"));
+  CHECK(calls == 2);
+
+  CHECK_THROWS_AS(state.run("add('1', 2)"), std::runtime_error);
+  CHECK_THROWS_AS(state.run("greet()"), std::runtime_error);
+  CHECK_NOTHROW(state.run("assert(not pcall(add, 1))"));
+
+  SUBCASE("created functions") {
+    auto multiply = state.createFunction([](int64_t a, int64_t b) { return a * b; });
+    CHECK(multiply.asFunction()(6, 7).get<int>() == 42);
+    state.root()["multiply"] = multiply;
+    CHECK(state.get<int>("multiply(2, 3)") == 6);
+    CHECK_THROWS_AS(state.run("multiply(2.5, 3)"), std::runtime_error);
+  }
+
+  SUBCASE("narrow integers") {
+    state.bind("byte", [](uint8_t value) { return value; });
+    state.bind("int", [](int32_t value) { return value; });
+    state.bind("size", [](uint64_t value) { return value; });
+    CHECK(state.get<int>("byte(255)") == 255);
+    CHECK_THROWS_AS(state.run("byte(256)"), std::runtime_error);
+    CHECK_THROWS_AS(state.run("byte(-1)"), std::runtime_error);
+    CHECK(state.get<int>("int(-2147483648)") == -2147483648ll);
+    CHECK_THROWS_AS(state.run("int(2147483648)"), std::runtime_error);
+    CHECK_THROWS_AS(state.run("size(-1)"), std::runtime_error);
+    CHECK(state.get<int64_t>("size(math.maxinteger)") == std::numeric_limits<int64_t>::max());
+  }
+}
+
+TEST_CASE("Multiple results") {
+  glue::lua::State state;
+  state.openStandardLibs();
+  auto root = state.root();
+
+  SUBCASE("lua to C++") {
+    auto results = state.call(state.get("function(a, b) return a + b, a * b, 'x' end"), 2, 3);
+    REQUIRE(results.size() == 3);
+    CHECK(results.get<int>(0) == 5);
+    CHECK(results.get<int>(1) == 6);
+    CHECK(results.get<std::string>(2) == "x");
+    CHECK(state.call(state.get("function() end")).empty());
+    CHECK(state.call(state.get("function(...) return ... end"), 1, 2, 3, 4, 5, 6).size() == 6);
+    glue::AnyArguments many(1000, glue::Any(1));
+    auto count = state.get("function(...) return select('#', ...) end");
+    CHECK(state.call(count, many).get<int>(0) == 1000);
+    CHECK(count.asFunction().call(many).get<int>() == 1000);
+    CHECK(state.call(state.get("function(...) return ... end"), many).size() == 1000);
+    CHECK_THROWS_AS(state.call(state.get("function() error('x') end")), std::runtime_error);
+  }
+
+  SUBCASE("C++ to lua") {
+    root["divide"] = [](int a, int b) { return glue::lua::Results{a / b, a % b}; };
+    CHECK_NOTHROW(state.run("q, r = divide(7, 2); assert(q == 3 and r == 1)"));
+    state.bind("minmax", [](double a, double b) {
+      return a < b ? std::make_tuple(a, b) : std::make_tuple(b, a);
+    });
+    CHECK_NOTHROW(state.run("lo, hi = minmax(3, 1); assert(lo == 1 and hi == 3)"));
+    state.bind("none", []() { return glue::lua::Results(); });
+    CHECK(state.get<int>("select('#', none())") == 0);
+  }
+
+  SUBCASE("varargs") {
+    state.bind("count",
+               [](int first, glue::lua::Results rest) { return first + int(rest.size()); });
+    CHECK(state.get<int>("count(10, 'a', 'b', nil, 'c')") == 14);
+    CHECK(state.get<int>("count(10)") == 10);
+  }
+}
+
+TEST_CASE("String references") {
+  glue::lua::State state;
+  state.openStandardLibs();
+  auto root = state.root();
+  state.run("long = string.rep('x', 4096)");
+
+  CHECK(state.get<std::string>("long") == std::string(4096, 'x'));
+  CHECK(state.get<std::string>("'short'") == "short");
+
+  glue::lua::StringRef reference;
+  state.bind("keep", [&](glue::lua::StringRef value) { reference = value; });
+  state.run("keep(long)");
+  CHECK(reference.size() == 4096);
+  CHECK(reference == std::string(4096, 'x'));
+  state.run("long = nil");
+  state.collectGarbage();
+  CHECK(reference.view() == std::string(4096, 'x'));
+
+  root["copy"] = reference;
+  CHECK(state.get<int>("#copy") == 4096);
+  CHECK(root["copy"]->get<std::string>().size() == 4096);
+
+  state.bind("first", [](glue::lua::StringRef value) { return value.view().substr(0, 1); });
+  CHECK(state.get<std::string>("first('abc')") == "a");
+
+  SUBCASE("references outlive their state") {
+    glue::lua::StringRef outliving;
+    {
+      glue::lua::State other;
+      other.bind("keep", [&](glue::lua::StringRef value) { outliving = value; });
+      other.run("keep(string.rep('y', 4096))");
+    }
+    CHECK(outliving == std::string(4096, 'y'));
+    root["copy"] = outliving;
+    CHECK(state.get<int>("#copy") == 4096);
+  }
+}
+
+TEST_CASE("Coroutines") {
+  using Status = glue::lua::Coroutine::Status;
+  glue::lua::State state;
+  state.openStandardLibs();
+  auto root = state.root();
+
+  std::vector<std::string> requests;
+  state.bind("fetch", [&](const std::string &url) {
+    requests.push_back(url);
+    return glue::lua::Yield{{url}};
+  });
+  root["wait"] = [](int ticks) { return glue::lua::Yield{{ticks}}; };
+
+  auto coroutine = state.createCoroutine(state.compile(R"(
+    local a = fetch('a')
+    local b = fetch('b')
+    return a .. b
+  )"));
+  CHECK(coroutine.status() == Status::Suspended);
+
+  auto results = coroutine.resume();
+  REQUIRE(results.size() == 1);
+  CHECK(results.get<std::string>(0) == "a");
+  CHECK(coroutine.isSuspended());
+  CHECK(coroutine.resume("A").get<std::string>(0) == "b");
+  CHECK(coroutine.resume("B").get<std::string>(0) == "AB");
+  CHECK(coroutine.isDone());
+  CHECK(requests == std::vector<std::string>{"a", "b"});
+  CHECK_THROWS_AS(coroutine.resume(), std::runtime_error);
+
+  SUBCASE("functions") {
+    auto counter = state.createCoroutine(
+        state.get("function(n) for i = 1, n do coroutine.yield(i) end return 'done' end"));
+    CHECK(counter.resume(3).get<int>(0) == 1);
+    CHECK(counter.resume().get<int>(0) == 2);
+    CHECK(counter.resume().get<int>(0) == 3);
+    CHECK(counter.resume().get<std::string>(0) == "done");
+  }
+
+  SUBCASE("type-erased functions") {
+    auto waiting = state.createCoroutine(state.get("function() return wait(5) + 1 end"));
+    CHECK(waiting.resume().get<int>(0) == 5);
+    CHECK(waiting.resume(10).get<int>(0) == 11);
+  }
+
+  SUBCASE("many coroutines") {
+    std::vector<glue::lua::Coroutine> coroutines;
+    auto function = state.get("function(i) local x = fetch(i) return x * 2 end");
+    for (int i = 0; i < 1000; ++i) {
+      coroutines.push_back(state.createCoroutine(function));
+      coroutines.back().resume(std::to_string(i));
+    }
+    for (int i = 0; i < 1000; ++i) {
+      CHECK(coroutines[i].resume(i).get<int>(0) == i * 2);
+    }
+  }
+
+  SUBCASE("errors") {
+    auto failing = state.createCoroutine(state.get("function() fetch('x') error('failed') end"));
+    failing.resume();
+    CHECK(failing.resume().empty());
+    CHECK(failing.status() == Status::Error);
+    CHECK(failing.error().find("failed") != std::string::npos);
+    CHECK_THROWS_AS(state.createCoroutine(state.get("42")), std::runtime_error);
+    CHECK_THROWS_AS(state.run("fetch('main')"), std::runtime_error);
+  }
+}
+
+TEST_CASE("Budgets") {
+  glue::lua::State state;
+  state.openStandardLibs();
+
+  glue::lua::Budget budget;
+  budget.instructions = 100000;
+  state.setBudget(budget);
+
+  CHECK(state.get<int>("1 + 1") == 2);
+  CHECK_THROWS_AS(state.run("while true do end"), glue::lua::BudgetExceeded);
+  CHECK_THROWS_AS(state.run("while true do pcall(function() while true do end end) end"),
+                  glue::lua::BudgetExceeded);
+  CHECK_THROWS_AS(state.run("error('x')"), std::runtime_error);
+  CHECK_NOTHROW(state.run("for i = 1, 100 do end"));
+
+  SUBCASE("time") {
+    glue::lua::Budget timeBudget;
+    timeBudget.time = std::chrono::milliseconds(10);
+    state.setBudget(timeBudget);
+    CHECK_THROWS_AS(state.run("while true do end"), glue::lua::BudgetExceeded);
+    CHECK_THROWS_AS(state.call(state.get("function() while true do end end")),
+                    glue::lua::BudgetExceeded);
+  }
+
+  SUBCASE("callbacks") {
+    auto callback = state.get("function() while true do end end").asFunction();
+    CHECK_THROWS_AS(callback(), glue::lua::BudgetExceeded);
+    CHECK(state.get<int>("1 + 1") == 2);
+  }
+
+  SUBCASE("no budget") {
+    state.setBudget(glue::lua::Budget());
+    CHECK_NOTHROW(state.run("for i = 1, 1000000 do end"));
+  }
+
+  SUBCASE("hooks of the application") {
+    state.run("lines = 0; debug.sethook(function() lines = lines + 1 end, 'l')");
+    CHECK_THROWS_AS(state.run("while true do end"), glue::lua::BudgetExceeded);
+    state.setBudget(glue::lua::Budget());
+    CHECK(state.get<int>("lines") > 0);
+    CHECK(state.get<bool>("type(debug.gethook()) == 'function'"));
+    state.run("debug.sethook()");
+  }
+
+  SUBCASE("time slices") {
+    glue::lua::Budget slice;
+    slice.instructions = 10000;
+    slice.action = glue::lua::Budget::Action::Suspend;
+    auto coroutine = state.createCoroutine(
+        state.get("function() local x = 0 for i = 1, 100000 do x = x + i end return x end"));
+    coroutine.setBudget(slice);
+    int slices = 0;
+    glue::lua::Results results;
+    while (coroutine.isSuspended()) {
+      results = coroutine.resume();
+      CHECK(coroutine.wasPreempted() == coroutine.isSuspended());
+      ++slices;
+    }
+    CHECK(coroutine.isDone());
+    CHECK(slices > 1);
+    CHECK(results.get<int64_t>(0) == int64_t(100000) * 100001 / 2);
+  }
+
+  SUBCASE("coroutines created by scripts are not suspended") {
+    glue::lua::Budget slice;
+    slice.instructions = 10000;
+    slice.action = glue::lua::Budget::Action::Suspend;
+    auto coroutine = state.createCoroutine(state.get(R"(function()
+      local ok = pcall(coroutine.wrap(function() while true do end end))
+      for i = 1, 100000 do end
+      return ok
+    end)"));
+    coroutine.setBudget(slice);
+    coroutine.resume();
+    CHECK(coroutine.wasPreempted());
+    glue::lua::Results results;
+    while (coroutine.isSuspended()) {
+      results = coroutine.resume();
+    }
+    REQUIRE(coroutine.isDone());
+    CHECK(results.get<bool>(0) == false);
+  }
+}
+
 TEST_CASE("C++ passthrough arguments") {
   glue::lua::State state;
   state.openStandardLibs();
@@ -162,6 +515,405 @@ TEST_CASE("Lua passthrough arguments") {
   test(std::string("48"));
 }
 
+TEST_CASE("Sequences") {
+  glue::lua::State state;
+  state.openStandardLibs();
+  auto root = state.root();
+
+  SUBCASE("views of lua arrays") {
+    glue::lua::Sequence sequence(state.get("{1, 2.5, 'three'}"));
+    CHECK(sequence.size() == 3);
+    CHECK(sequence[0]->get<int>() == 1);
+    CHECK(sequence[1]->get<double>() == 2.5);
+    CHECK(sequence[2]->get<std::string>() == "three");
+    CHECK(!sequence[3]);
+    sequence.set(3, 4);
+    CHECK(sequence.size() == 4);
+    CHECK_THROWS_AS(glue::lua::Sequence(state.get("42")), std::runtime_error);
+  }
+
+  SUBCASE("bulk transfer to lua") {
+    root["numbers"] = std::vector<double>{1.5, 2.5, 3.5};
+    root["integers"] = std::vector<int64_t>{1, 2, 3};
+    root["strings"] = std::vector<std::string>{"a", "b"};
+    CHECK_NOTHROW(state.run("assert(#numbers == 3 and numbers[2] == 2.5)"));
+    CHECK_NOTHROW(state.run("assert(#integers == 3 and math.type(integers[3]) == 'integer')"));
+    CHECK_NOTHROW(state.run("assert(#strings == 2 and strings[1] == 'a')"));
+  }
+
+  SUBCASE("bulk transfer to C++") {
+    glue::lua::Sequence sequence(state.get("{1, 2, 3}"));
+    CHECK(sequence.toVector<double>() == std::vector<double>{1, 2, 3});
+    CHECK(sequence.toVector<int64_t>() == std::vector<int64_t>{1, 2, 3});
+    CHECK_THROWS_AS(sequence.toVector<std::string>(), std::runtime_error);
+    CHECK(glue::lua::Sequence(state.get("{'a', 'b'}")).toVector<std::string>()
+          == std::vector<std::string>{"a", "b"});
+    CHECK_THROWS_AS(glue::lua::Sequence(state.get("{1.5}")).toVector<int64_t>(),
+                    std::runtime_error);
+  }
+}
+
+TEST_CASE("Batch calls") {
+  glue::lua::State state;
+  auto f = state.get("function(a, b) return a * b end");
+  std::vector<double> a{1, 2, 3, 4};
+  std::vector<int32_t> b{10, 20, 30, 40};
+  glue::lua::Batch batch(a.size());
+  batch.addColumn(glue::lua::Buffer(a.data(), a.size()))
+      .addColumn(glue::lua::Buffer(b.data(), b.size()));
+
+  CHECK(state.callBatch(f, batch) == std::vector<double>{10, 40, 90, 160});
+
+  std::vector<int64_t> results(2);
+  state.callBatch(f, batch.slice(2, 2), glue::lua::Buffer(results.data(), results.size()));
+  CHECK(results == std::vector<int64_t>{90, 160});
+
+  CHECK_THROWS_AS(batch.addColumn(glue::lua::Buffer(b.data(), 2)), std::invalid_argument);
+  CHECK_THROWS_AS(state.callBatch(state.get("function() return 'x' end"), batch),
+                  std::runtime_error);
+  CHECK_THROWS_AS(state.callBatch(state.get("function() error('x') end"), batch),
+                  std::runtime_error);
+  CHECK_THROWS_WITH(state.callBatch(state.get("function() return 0.5 end"), batch.slice(0, 2),
+                                    glue::lua::Buffer(results.data(), results.size())),
+                    "batch call 0 returned non-integer number for int64 buffer");
+  CHECK_THROWS_WITH(state.callBatch(state.get("function() return '12' end"), batch),
+                    "batch call 0 returned string instead of a number");
+  std::vector<uint8_t> bytes(2);
+  CHECK_THROWS_WITH(state.callBatch(state.get("function(a) return a * 200 end"),
+                                    batch.slice(0, 2), glue::lua::Buffer(bytes.data(), 2)),
+                    "batch call 1 returned number out of range for uint8 buffer");
+  CHECK(bytes == std::vector<uint8_t>{200, 0});
+  CHECK(state.get<int>("1 + 1") == 2);
+}
+
+TEST_CASE("State templates") {
+  auto module = glue::createAnyMap();
+  module["value"] = 42;
+  module["twice"] = [](int x) { return 2 * x; };
+
+  glue::lua::StateTemplate stateTemplate;
+  stateTemplate.openStandardLibs().addModule(module).run(
+      "counter = 0; function next() counter = counter + 1; return twice(counter) end");
+  CHECK_THROWS_AS(glue::lua::StateTemplate().run("function("), std::runtime_error);
+
+  auto a = stateTemplate.create();
+  auto b = stateTemplate.create(std::make_shared<glue::lua::PoolAllocator>());
+  CHECK(a->get<int>("value") == 42);
+  CHECK(a->get<int>("next()") == 2);
+  CHECK(a->get<int>("next()") == 4);
+  CHECK(b->get<int>("next()") == 2);
+  CHECK(b->get<std::string>("string.rep('x', 2)") == "xx");
+
+  glue::lua::State c;
+  CHECK_THROWS_AS(glue::lua::StateTemplate().run("error('failed')").initialize(c),
+                  std::runtime_error);
+  c.openStandardLibs();
+  CHECK_THROWS_WITH(glue::lua::StateTemplate().run("error({})").initialize(c),
+                    "error object is a table value");
+
+  glue::lua::Budget budget;
+  budget.instructions = 10000;
+  c.setBudget(budget);
+  CHECK_THROWS_AS(glue::lua::StateTemplate().run("while true do end").initialize(c),
+                  glue::lua::BudgetExceeded);
+}
+
+TEST_CASE("Shared data") {
+  using glue::lua::SharedData;
+  SharedData data(SharedData::Table{
+      {"name", "balance"},
+      {"rates", SharedData::Array{1.5, 2, 3}},
+      {"units", SharedData::Table{{"archer", SharedData::Table{{"cost", 50}}}}},
+  });
+
+  glue::lua::State a, b;
+  a.root()["data"] = data;
+  b.root()["data"] = data;
+
+  CHECK(a.get<std::string>("data.name") == "balance");
+  CHECK(a.get<double>("data.rates[1]") == 1.5);
+  CHECK(a.get<int>("#data.rates") == 3);
+  CHECK(a.get<int>("#data.units") == 0);
+  CHECK(a.get<int>("data.units.archer.cost") == 50);
+  CHECK(!a.run("return data.units.knight"));
+  CHECK(!a.run("return data.rates[4]"));
+  CHECK(b.get<int>("data.units.archer.cost") == 50);
+  CHECK(a.get<bool>("data.units == data.units"));
+
+  CHECK(a.get<double>("local s = 0 for i, v in pairs(data.rates) do s = s + i * v end return s")
+        == 14.5);
+  CHECK(a.get<std::string>("local k = '' for key in pairs(data) do k = k .. key end return k")
+        == "nameratesunits");
+
+  CHECK_THROWS(a.run("data.name = 'x'"));
+  CHECK_THROWS(a.run("data.rates[1] = 2"));
+
+  auto units = a.get("data.units");
+  CHECK(units->get<SharedData>().isSame(data["units"]));
+
+  a.openStandardLibs();
+  CHECK(a.get<std::string>("getmetatable(data.units)") == "LuaGlueSharedData");
+  CHECK(!a.run("return data.__index"));
+}
+
+TEST_CASE("Inline types") {
+  struct Vector {
+    double x, y;
+    Vector(double vx, double vy) : x(vx), y(vy) {}
+  };
+
+  auto module = glue::createAnyMap();
+  module["Vector"]
+      = glue::createClass<Vector>()
+            .addConstructor<double, double>()
+            .addMember("x", &Vector::x)
+            .addMember("y", &Vector::y)
+            .addMethod(glue::keys::operators::add, [](const Vector &a, const Vector &b) {
+              return Vector(a.x + b.x, a.y + b.y);
+            });
+
+  glue::lua::State state;
+  state.openStandardLibs();
+  state.addModule(module);
+  state.addInlineType<Vector>();
+
+  state.run("a = Vector.__new(1, 2); b = a + Vector.__new(3, 4)");
+  CHECK(state.get<double>("b:x()") == 4);
+  CHECK(state.get<double>("b:y()") == 6);
+  CHECK(state.get<bool>("getmetatable(b).__gc == nil"));
+  CHECK(state.get<std::string>("type(b)") == "userdata");
+  CHECK(state.get<std::string>("tostring(b)").find('(') != std::string::npos);
+
+  auto b = state.get("b")->get<Vector>();
+  CHECK(b.x == 4);
+  CHECK(b.y == 6);
+  state.root()["c"] = Vector(5, 6);
+  CHECK(state.get<double>("c:x() + c:y()") == 11);
+
+  // inline values are copies
+  state.run("a:setX(10)");
+  CHECK(state.get<double>("a:x()") == 1);
+}
+
+TEST_CASE("Garbage collection") {
+  glue::lua::State state;
+  auto allocate = state.get("function() local t = {} for i = 1, 10000 do t[i] = {i} end end");
+
+  SUBCASE("full") {
+    state.call(allocate);
+    state.collectGarbage();
+    auto stats = state.gcStats();
+    CHECK(stats.fullCollections == 1);
+    CHECK(stats.heapAfter < stats.heapBefore);
+    CHECK(stats.totalPause == stats.lastPause);
+  }
+
+  SUBCASE("incremental steps") {
+    state.setIncrementalGC(glue::lua::IncrementalGC{200, 200, 10});
+    state.setGCRunning(false);
+    CHECK(!state.isGCRunning());
+    state.call(allocate);
+    while (!state.collectGarbageStep(size_t(64))) {
+    }
+    auto stats = state.gcStats();
+    CHECK(stats.steps > 0);
+    CHECK(stats.completedCycles == 1);
+    CHECK(state.collectGarbageStep(std::chrono::seconds(1)));
+    state.setGCRunning(true);
+    CHECK(state.isGCRunning());
+  }
+
+  SUBCASE("generational") {
+    state.setGenerationalGC();
+    for (int i = 0; i < 10; ++i) {
+      state.call(allocate);
+      state.collectGarbageStep(std::chrono::milliseconds(1));
+    }
+    CHECK(state.gcStats().steps == 10);
+    CHECK(state.gcStats().completedCycles == 10);
+    CHECK(state.gcStats().maxPause >= state.gcStats().lastPause);
+  }
+
+  SUBCASE("modes switched by scripts") {
+    state.openStandardLibs();
+    state.setIncrementalGC();
+    CHECK(state.get<std::string>("collectgarbage('generational')") == "incremental");
+    CHECK(state.collectGarbageStep(std::chrono::milliseconds(1)));
+    CHECK(state.gcStats().steps == 1);
+    CHECK(state.get<std::string>("collectgarbage('incremental')") == "generational");
+  }
+}
+
+TEST_CASE("Non-throwing errors") {
+  glue::lua::State state;
+  state.openStandardLibs();
+
+  auto result = state.tryRun("return 1 + 2");
+  REQUIRE(result);
+  CHECK(result->get<int>() == 3);
+
+  result = state.tryRun("local x = nil\nreturn x.y", "validation");
+  REQUIRE(!result);
+  CHECK(result.error().message.find("attempt to index") != std::string_view::npos);
+  CHECK(result.error().chunk == "[string \"validation\"]");
+  CHECK(result.error().line == 2);
+  CHECK(result.error().traceback.empty());
+  CHECK_THROWS_AS(result.value(), std::runtime_error);
+
+  CHECK(state.tryRun("error({})").error().message == "error object is a table value");
+  CHECK(!state.tryRun("syntax error"));
+
+  state.run("function check(x) if x < 0 then error('negative') end return x, -x end");
+  auto results = state.tryCall(state.get("check"), 2);
+  REQUIRE(results);
+  CHECK(results->get<int>(1) == -2);
+  auto failed = state.tryCall(state.get("check"), -1);
+  REQUIRE(!failed);
+  CHECK(failed.error().message.find("negative") != std::string_view::npos);
+  CHECK(state.get<int>("1 + 1") == 2);
+
+  state.root()["fail"] = []() { throw std::runtime_error("native failure"); };
+  CHECK(state.tryCall(state.get("fail")).error().message.find("native failure")
+        != std::string_view::npos);
+
+  SUBCASE("tracebacks") {
+    state.setErrorTracebacks(true);
+    auto error = state.tryCall(state.get("check"), -1).error();
+    CHECK(error.traceback.find("stack traceback") != std::string_view::npos);
+  }
+
+  SUBCASE("budgets") {
+    glue::lua::Budget budget;
+    budget.instructions = 10000;
+    state.setBudget(budget);
+    CHECK(state.tryRun("while true do end").error().budgetExceeded);
+    CHECK(!state.tryRun("error('x')").error().budgetExceeded);
+  }
+
+  SUBCASE("lua functions called from C++") {
+    auto check = state.get("check").asFunction();
+    CHECK_THROWS_AS(check(-1), std::runtime_error);
+    CHECK(check(1).get<int>() == 1);
+  }
+
+  SUBCASE("error objects passing through native functions") {
+    state.root()["invoke"] = [](glue::AnyFunction f) { return f(); };
+    state.run("object = {}");
+    CHECK(state.get<bool>("local ok, e = pcall(invoke, function() error(object) end) "
+                          "return e == object"));
+    CHECK_THROWS_WITH(state.get("function() error(object) end").asFunction()(),
+                      "error object is a table value");
+  }
+}
+
+TEST_CASE("Buffers") {
+  glue::lua::State state;
+  state.openStandardLibs();
+  auto root = state.root();
+
+  auto values = std::make_shared<std::vector<double>>(std::vector<double>{1, 2, 3, 4});
+  root["buffer"] = glue::lua::Buffer(values);
+
+  CHECK(state.get<int>("#buffer") == 4);
+  CHECK(state.get<double>("buffer[2]") == 2);
+  CHECK(state.get<int>("buffer:size()") == 4);
+  CHECK(!state.run("return buffer[5]"));
+  CHECK_NOTHROW(state.run("buffer[1] = 10"));
+  CHECK((*values)[0] == 10);
+  CHECK_THROWS_AS(state.run("buffer[5] = 1"), std::runtime_error);
+  CHECK_THROWS_AS(state.run("buffer[1] = 'x'"), std::runtime_error);
+
+  SUBCASE("slices") {
+    CHECK_NOTHROW(state.run("slice = buffer:slice(2, 3); slice[1] = 20"));
+    CHECK(state.get<int>("#slice") == 2);
+    CHECK((*values)[1] == 20);
+    CHECK_THROWS_AS(state.run("buffer:slice(0, 2)"), std::runtime_error);
+    auto slice = root["slice"]->get<glue::lua::Buffer>();
+    CHECK(slice.size() == 2);
+    CHECK(slice.as<double>()[1] == 3);
+    CHECK_THROWS_AS(slice.as<float>(), std::runtime_error);
+  }
+
+  SUBCASE("metamethods are not accessible") {
+    CHECK(!state.run("return buffer.__gc"));
+    CHECK(!state.run("return buffer.__index"));
+    CHECK(state.get<std::string>("getmetatable(buffer)") == "LuaGlueBuffer");
+  }
+
+  SUBCASE("read-only buffers") {
+    const int32_t constants[] = {1, 2, 3};
+    root["constants"] = glue::lua::Buffer(constants, 3);
+    CHECK(state.get<int>("constants[3]") == 3);
+    CHECK_THROWS_AS(state.run("constants[1] = 2"), std::runtime_error);
+  }
+
+  SUBCASE("narrow integers") {
+    auto bytes = std::make_shared<std::vector<uint8_t>>(2);
+    auto integers = std::make_shared<std::vector<int32_t>>(2);
+    root["bytes"] = glue::lua::Buffer(bytes);
+    root["integers"] = glue::lua::Buffer(integers);
+    CHECK_NOTHROW(state.run("bytes[1] = 255; integers[1] = -2147483648"));
+    CHECK((*bytes)[0] == 255);
+    CHECK((*integers)[0] == std::numeric_limits<int32_t>::min());
+    CHECK_THROWS_AS(state.run("bytes[2] = 300"), std::runtime_error);
+    CHECK_THROWS_AS(state.run("bytes[2] = -1"), std::runtime_error);
+    CHECK_THROWS_AS(state.run("integers[2] = 2147483648"), std::runtime_error);
+    CHECK((*bytes)[1] == 0);
+    CHECK((*integers)[1] == 0);
+  }
+
+  SUBCASE("buffers keep their owner alive") {
+    std::weak_ptr<std::vector<double>> weak = values;
+    values.reset();
+    CHECK(!weak.expired());
+    root["buffer"] = glue::Any();
+    state.collectGarbage();
+    CHECK(weak.expired());
+  }
+}
+
+TEST_CASE("Pool allocator") {
+  auto allocator = std::make_shared<glue::lua::PoolAllocator>();
+  glue::lua::State state(allocator);
+  state.openStandardLibs();
+
+  auto &stats = allocator->stats();
+  CHECK(stats.allocations > 0);
+  CHECK(stats.liveBytes > 0);
+  CHECK(stats.peakBytes >= stats.liveBytes);
+  CHECK(stats.reservedBytes >= stats.liveBytes);
+  CHECK(state.memoryStats().liveBytes == stats.liveBytes);
+
+  CHECK_NOTHROW(state.run("t = {} for i = 1, 1000 do t[i] = tostring(i) .. 'x' end"));
+  CHECK(state.get<std::string>("t[1000]") == "1000x");
+  auto peak = stats.peakBytes;
+  CHECK_NOTHROW(state.run("t = nil"));
+  state.collectGarbage();
+  CHECK(stats.liveBytes < peak);
+  CHECK(stats.deallocations > 0);
+
+  SUBCASE("memory limit") {
+    allocator->setLimit(stats.liveBytes + 64 * 1024);
+    CHECK_THROWS_AS(state.run("local t = {} for i = 1, 1e6 do t[i] = i end"), std::runtime_error);
+    CHECK(stats.failedAllocations > 0);
+    CHECK(stats.liveBytes <= stats.limit);
+    state.collectGarbage();
+    CHECK(state.get<int>("1 + 1") == 2);
+  }
+
+  SUBCASE("native functions exceeding the limit") {
+    state.root()["makeString"] = [](int size) { return std::string(size_t(size), 'x'); };
+    allocator->setLimit(stats.liveBytes + 64 * 1024);
+    CHECK(state.get<int>("#makeString(1024)") == 1024);
+    CHECK_THROWS_AS(state.run("local s = makeString(128 * 1024) "
+                              "local t = {} for i = 1, 100 do t[i] = {} end"),
+                    std::runtime_error);
+    state.collectGarbage();
+    CHECK(stats.liveBytes <= stats.limit);
+    CHECK(state.get<int>("1 + 1") == 2);
+  }
+}
+
 TEST_CASE("Run file") {
 #if defined(WIN32) || defined(_WIN32) || defined(__WIN32) && !defined(__CYGWIN__)
   static const std::string slash = "\\";
@@ -173,6 +925,80 @@ TEST_CASE("Run file") {
   glue::lua::State state;
   CHECK(state.runFile(dirPath + slash + "test.lua")->get<std::string>() == "Hello Lua!");
   CHECK_THROWS_AS(state.runFile("this file does not exist"), std::runtime_error);
+
+  SUBCASE("memory limit") {
+    auto path = (std::filesystem::temp_directory_path() / "LuaGlueMemoryLimitTest.lua").string();
+    {
+      std::ofstream file(path, std::ios::trunc);
+      file << "local t = {} for i = 1, 1e6 do t[i] = i end";
+    }
+    auto allocator = std::make_shared<glue::lua::PoolAllocator>();
+    glue::lua::State limited(allocator);
+    allocator->setLimit(allocator->stats().liveBytes + 64 * 1024);
+    CHECK_THROWS_AS(limited.runFile(path), std::runtime_error);
+    CHECK(allocator->stats().failedAllocations > 0);
+    std::filesystem::remove(path);
+  }
+}
+
+TEST_CASE("Bytecode cache") {
+  namespace fs = std::filesystem;
+  auto directory = fs::temp_directory_path() / "LuaGlueBytecodeCacheTest";
+  fs::remove_all(directory);
+  auto scriptPath = (directory / "script.lua").string();
+  fs::create_directories(directory);
+
+  auto writeScript = [&](const std::string &code) {
+    std::ofstream file(scriptPath, std::ios::trunc);
+    file << code;
+  };
+
+  writeScript("#!/usr/bin/env lua\nreturn 'first'");
+
+  {
+    glue::lua::State state;
+    state.setBytecodeCacheDirectory((directory / "cache").string());
+    CHECK(state.runFile(scriptPath)->get<std::string>() == "first");
+    CHECK(state.runFile(scriptPath)->get<std::string>() == "first");
+    CHECK(!fs::is_empty(directory / "cache"));
+    CHECK_THROWS_AS(state.runFile("this file does not exist"), std::runtime_error);
+  }
+
+  writeScript("return 'second'");
+
+  {
+    glue::lua::State state;
+    state.setBytecodeCacheDirectory((directory / "cache").string());
+    CHECK(state.runFile(scriptPath)->get<std::string>() == "second");
+  }
+
+  SUBCASE("edits keeping size and modification time") {
+    auto modified = fs::last_write_time(scriptPath);
+    writeScript("return 'SECOND'");
+    fs::last_write_time(scriptPath, modified);
+    glue::lua::State state;
+    state.setBytecodeCacheDirectory((directory / "cache").string());
+    CHECK(state.runFile(scriptPath)->get<std::string>() == "SECOND");
+  }
+
+  SUBCASE("corrupted cache files") {
+    for (auto &entry : fs::directory_iterator(directory / "cache")) {
+      fs::resize_file(entry.path(), fs::file_size(entry.path()) - 4);
+    }
+    glue::lua::State state;
+    state.setBytecodeCacheDirectory((directory / "cache").string());
+    CHECK(state.runFile(scriptPath)->get<std::string>() == "second");
+  }
+
+  writeScript("return syntax error");
+
+  {
+    glue::lua::State state;
+    state.setBytecodeCacheDirectory((directory / "cache").string());
+    CHECK_THROWS_AS(state.runFile(scriptPath), std::runtime_error);
+  }
+
+  fs::remove_all(directory);
 }
 
 TEST_CASE("Share state") {
@@ -184,6 +1010,120 @@ TEST_CASE("Share state") {
   CHECK(state.root()["x"]->get<int>() == 42);
 }
 
+TEST_CASE("Boundary stats") {
+  using glue::lua::LuaType;
+  glue::lua::State state;
+  auto root = state.root();
+  root["add"] = [](int a, int b) { return a + b; };
+  state.resetStats();
+
+  CHECK(state.get<int>("add(1, 2)") == 3);
+  auto map = glue::createAnyMap();
+  map["a"] = 1;
+  CHECK(state.call(state.get("function(x) return x end"), map.data).size() == 1);
+
+  auto stats = state.stats();
+  if (glue::lua::BoundaryStats::enabled) {
+    CHECK(stats.callsFromLua == 1);
+    CHECK(stats.callsIntoLua == 1);
+    CHECK(stats.fromLua(LuaType::Number) >= 1);
+    CHECK(stats.fromLua(LuaType::Table) == 1);
+    CHECK(stats.toLua(LuaType::Table) == 1);
+    CHECK(stats.toLua(LuaType::Number) >= 1);
+    CHECK(stats.tablesCopied == 1);
+    CHECK(stats.conversionTime.count() > 0);
+  } else {
+    CHECK(stats.callsFromLua == 0);
+    CHECK(stats.conversionTime.count() == 0);
+  }
+
+  state.resetStats();
+  CHECK(state.stats().callsFromLua == 0);
+}
+
+TEST_CASE("Profiler") {
+  glue::lua::State state;
+  state.openStandardLibs();
+  auto root = state.root();
+  root["work"] = [](int n) {
+    double x = 0;
+    for (int i = 0; i < n; ++i) x += i;
+    return x;
+  };
+
+  glue::lua::ProfilerOptions options;
+  options.interval = 100;
+  state.startProfiler(options);
+  CHECK(state.isProfiling());
+  state.run(R"(
+    function compute()
+      local x = 0
+      for i = 1, 100000 do x = x + i end
+      return x
+    end
+    for i = 1, 10 do
+      compute()
+      work(100000)
+    end
+  )", "profiled");
+  state.stopProfiler();
+  CHECK(!state.isProfiling());
+
+  auto profile = state.profile();
+  CHECK(profile.samples > 0);
+  auto folded = profile.foldedStacks();
+  CHECK(folded.find("compute (") != std::string::npos);
+  CHECK(folded.find("[native] work") != std::string::npos);
+
+  auto functions = profile.functions();
+  REQUIRE(!functions.empty());
+  for (auto &function : functions) {
+    CHECK(function.totalTime >= function.selfTime);
+  }
+
+  SUBCASE("stopped") {
+    state.run("compute()");
+    CHECK(state.profile().samples == profile.samples);
+  }
+
+  SUBCASE("hooks of the application") {
+    state.run("debug.sethook(function() end, 'c')");
+    state.startProfiler(options);
+    state.run("compute()");
+    state.stopProfiler();
+    CHECK(state.get<bool>("type(debug.gethook()) == 'function'"));
+    state.run("debug.sethook()");
+  }
+}
+
+TEST_CASE("Map identity cache") {
+  glue::lua::State state;
+  state.openStandardLibs();
+  auto root = state.root();
+  auto config = glue::createAnyMap();
+  config["value"] = 1;
+  state.run("function same(a, b) return a == b end");
+
+  CHECK(!state.call(state.get("same"), config.data, config.data).get<bool>(0));
+
+  state.setMapIdentityCache(true);
+  CHECK(state.call(state.get("same"), config.data, config.data).get<bool>(0));
+  root["config"] = config;
+  CHECK(state.get<bool>("same(config, config)"));
+  CHECK_NOTHROW(state.run("config.lua = true"));
+  root["config2"] = config;
+  CHECK(state.get<bool>("config2.lua"));
+
+  SUBCASE("invalidation") {
+    config["value"] = 2;
+    CHECK(state.get<int>("config.value") == 1);
+    state.invalidateMap(config);
+    root["config"] = config;
+    CHECK(state.get<int>("config.value") == 2);
+    CHECK(!state.get<bool>("same(config, config2)"));
+  }
+}
+
 TEST_CASE("Modules") {
   struct A {
     std::string member;
@@ -236,6 +1176,23 @@ TEST_CASE("Modules") {
     CHECK(state.run("local b = createB(); return b:member()")->as<std::string>() == "unnamed");
   }
 
+  SUBCASE("shared metatables") {
+    CHECK_NOTHROW(state.run(
+        "local a, b = B.__new('a'), createB(); assert(getmetatable(a) == getmetatable(b))"));
+    CHECK_NOTHROW(state.run("assert(getmetatable(B.__new('a')).__index == B)"));
+    CHECK_NOTHROW(
+        state.run("assert(getmetatable(B.__new('a')) ~= getmetatable(inner.A.__new()))"));
+    CHECK(state.run("local b = B.__new('x'); b:setMember('inherited'); return b:member()")
+              ->as<std::string>()
+          == "inherited");
+  }
+
+  SUBCASE("delete instances") {
+    state.root()["delete"] = state.getValueDeleter();
+    CHECK_NOTHROW(state.run("b = B.__new('x'); delete(b)"));
+    CHECK_THROWS(state.run("b:member()"));
+  }
+
   SUBCASE("operators") {
     CHECK_NOTHROW(state.run("local a = inner.A.__new(); return tostring(a)")->get<std::string>());
     CHECK(state.run("local b = createB(); return tostring(b)")->as<std::string>() == "B(unnamed)");
@@ -263,6 +1220,86 @@ TEST_CASE("Modules") {
   }
 }
 
+TEST_CASE("Lazy modules") {
+  struct A {
+    std::string member;
+  };
+
+  auto module = glue::createAnyMap();
+  auto inner = glue::createAnyMap();
+  inner["A"] = glue::createClass<A>().addConstructor<>().addMember("member", &A::member);
+  inner["value"] = 42;
+  module["inner"] = inner;
+  module["createA"] = []() { return A{"created"}; };
+  module["name"] = "module";
+
+  glue::lua::State state;
+  state.openStandardLibs();
+  state.addModule(module, glue::lua::ModuleLoading::Lazy);
+
+  CHECK(state.get<bool>("rawget(_G, 'inner') == nil"));
+  CHECK(state.get<int>("inner.value") == 42);
+  CHECK(state.get<bool>("rawget(_G, 'inner') ~= nil"));
+  CHECK(state.get<bool>("rawget(_G, 'name') == nil"));
+  CHECK(state.get<bool>("inner == inner and inner.A == inner.A"));
+  CHECK(state.get<std::string>("createA():member()") == "created");
+  CHECK(state.get<std::string>("local a = inner.A.__new(); a:setMember('x'); return a:member()")
+        == "x");
+  CHECK(!state.run("return missing"));
+  CHECK(!state.run("return missing"));
+  CHECK(state.get<int>("missing = 1; return missing") == 1);
+  CHECK(state.root()["name"]->get<std::string>() == "module");
+
+  SUBCASE("iteration") {
+    CHECK(state.get<int>("local n = 0; for k in pairs(inner) do n = n + 1 end; return n") == 2);
+    bool found = false;
+    state.root().forEach([&](auto &&key, auto &&) {
+      found = found || key == "createA";
+      return false;
+    });
+    CHECK(found);
+  }
+
+  SUBCASE("multiple modules") {
+    CHECK(!state.run("return extra"));
+    auto other = glue::createAnyMap();
+    other["name"] = "other";
+    other["extra"] = 1;
+    state.addModule(other, glue::lua::ModuleLoading::Lazy);
+    CHECK(state.get<std::string>("name") == "other");
+    CHECK(state.get<int>("extra") == 1);
+    CHECK(state.get<int>("inner.value") == 42);
+  }
+
+  SUBCASE("classes of instances are resolved on demand") {
+    glue::lua::State other;
+    other.addModule(module, glue::lua::ModuleLoading::Lazy);
+    CHECK(other.get<std::string>("createA():member()") == "created");
+    CHECK(other.get<bool>("rawget(_G, 'inner') == nil"));
+  }
+
+  SUBCASE("module owners are not accessible") {
+    CHECK(state.get<std::string>("getmetatable(_G)") == "LuaGlueModule");
+    CHECK_THROWS_AS(state.run("local metatable = getmetatable(_G) "
+                              "for _, owner in pairs(metatable) do "
+                              "  if type(owner) == 'userdata' then getmetatable(owner).__gc(owner) end "
+                              "end"),
+                    std::runtime_error);
+    CHECK_THROWS_AS(state.run("for _, owner in pairs(debug.getmetatable(_G)) do "
+                              "  if type(owner) == 'userdata' then debug.getmetatable(owner).__gc() end "
+                              "end"),
+                    std::runtime_error);
+    CHECK(state.get<std::string>("name") == "module");
+  }
+
+  SUBCASE("lua targets") {
+    auto target = state.get("{existing = true}").asMap();
+    state.addModule(module, target, glue::lua::ModuleLoading::Lazy);
+    CHECK(target["existing"]->get<bool>());
+    CHECK(target["name"]->get<std::string>() == "module");
+  }
+}
+
 TEST_CASE("Lua lifetime") {
   glue::AnyFunction f;
   glue::MapValue m;
@@ -270,6 +1307,10 @@ TEST_CASE("Lua lifetime") {
     glue::lua::State state;
     f = state.get("function() end").asFunction();
     m = state.get("{a=1, b=2}").asMap();
+    auto copy = m;
+    CHECK(copy["a"]->get<int>() == 1);
   }
+  auto functionCopy = f;
+  auto mapCopy = m;
   // sanitizer will complain unless objects are safely destroyed
 }
\ No newline at end of file